@@ -5,7 +5,11 @@ INCLUDE_DIRECTORIES(${CMAKE_SOURCE_DIR}/lib)
 set(EXECUTABLE_OUTPUT_PATH ${PROJECT_BINARY_DIR}/bin)
 
 # Flags
-set(CMAKE_CXX_FLAGS "--std=c++11 -g -fmax-errors=1")
+set(CMAKE_CXX_FLAGS "--std=c++11 -g -O2 -fmax-errors=1")
+OPTION(GL_STATE_CHECK_ERRORS "Check for GL errors after every call the state cache issues" OFF)
+IF (GL_STATE_CHECK_ERRORS)
+	ADD_DEFINITIONS(-DGL_STATE_CHECK_ERRORS)
+ENDIF ()
 
 # Packages
 FIND_PACKAGE(OpenGL REQUIRED)
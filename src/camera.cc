@@ -67,9 +67,14 @@ void Camera::zoom(float dir) {
     eye_ = glm::vec3(0.0f, 0.0f, camera_distance_);
 }
 
+glm::vec3 Camera::get_eye_position() const
+{
+    return glm::vec3(eyeTranslateMat * rotateMat * glm::vec4(eye_, 1));
+}
+
 glm::mat4 Camera::get_view_matrix() const
 {
-    glm::vec3 newEye(eyeTranslateMat * rotateMat * glm::vec4(eye_, 1));
+    glm::vec3 newEye = get_eye_position();
     glm::vec3 newCenter(centerTranslateMat * rotateMat * glm::vec4(center_, 1));
 
     glm::vec3 Z = glm::normalize(newEye - newCenter);
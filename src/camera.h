@@ -6,6 +6,7 @@
 class Camera {
 public:
 	glm::mat4 get_view_matrix() const;
+	glm::vec3 get_eye_position() const;
 
     void yaw(float dir);
     void pitch(float dir);
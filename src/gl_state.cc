@@ -0,0 +1,278 @@
+#include <cstring>
+#include <iostream>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <debuggl.h>
+#include "gl_state.h"
+
+// A glGetError after each call is a round trip to the driver that the
+// counters would not show, so it is only built in on request. Errors are
+// otherwise caught by the next check outside the cache.
+#ifdef GL_STATE_CHECK_ERRORS
+#define GL_STATE_CALL(statement) CHECK_GL_ERROR(statement)
+#else
+#define GL_STATE_CALL(statement) do { statement; } while (0)
+#endif
+
+namespace {
+	// Bindings no valid call can match, so the next bind is issued.
+	const GLuint kUnknown = ~0u;
+};
+
+GLState::GLState()
+{
+	invalidate();
+}
+
+void
+GLState::invalidate()
+{
+	vertex_array_ = kUnknown;
+	framebuffer_ = kUnknown;
+	buffers_.clear();
+	element_buffers_.clear();
+	buffer_contents_.clear();
+	program_ = kUnknown;
+	active_texture_ = GL_NONE;
+	textures_.clear();
+	uniforms_.clear();
+	int_uniforms_.clear();
+	capabilities_.clear();
+	depth_func_ = GL_NONE;
+	for (int i = 0; i < 4; i++) {
+		clear_color_[i] = -1.0f;
+		viewport_[i] = -1;
+	}
+}
+
+// Counts the call and tells whether to issue it.
+bool
+GLState::changed(bool differs)
+{
+	if (differs)
+		frame_.issued++;
+	else
+		frame_.skipped++;
+	return differs;
+}
+
+GLuint&
+GLState::buffer_slot(GLenum target)
+{
+	if (target == GL_ELEMENT_ARRAY_BUFFER) {
+		auto slot = element_buffers_.insert(std::make_pair(vertex_array_, kUnknown));
+		return slot.first->second;
+	}
+	auto slot = buffers_.insert(std::make_pair(target, kUnknown));
+	return slot.first->second;
+}
+
+void
+GLState::bind_vertex_array(GLuint vao)
+{
+	if (!changed(vao != vertex_array_))
+		return;
+	GL_STATE_CALL(glBindVertexArray(vao));
+	vertex_array_ = vao;
+}
+
+// Draw and read framebuffers are always bound together.
+void
+GLState::bind_framebuffer(GLuint framebuffer)
+{
+	if (!changed(framebuffer != framebuffer_))
+		return;
+	GL_STATE_CALL(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer));
+	framebuffer_ = framebuffer;
+}
+
+void
+GLState::bind_buffer(GLenum target, GLuint buffer)
+{
+	GLuint& bound = buffer_slot(target);
+	if (!changed(buffer != bound))
+		return;
+	GL_STATE_CALL(glBindBuffer(target, buffer));
+	bound = buffer;
+}
+
+// Indexed bindings are set once at setup, so only the generic binding they
+// also change is tracked.
+void
+GLState::bind_buffer_base(GLenum target, GLuint index, GLuint buffer)
+{
+	changed(true);
+	GL_STATE_CALL(glBindBufferBase(target, index, buffer));
+	buffer_slot(target) = buffer;
+}
+
+void
+GLState::use_program(GLuint program)
+{
+	if (!changed(program != program_))
+		return;
+	GL_STATE_CALL(glUseProgram(program));
+	program_ = program;
+}
+
+void
+GLState::bind_texture(GLenum unit, GLenum target, GLuint texture)
+{
+	auto bound = textures_.insert(std::make_pair(std::make_pair(unit, target), kUnknown)).first;
+	if (!changed(texture != bound->second))
+		return;
+	if (changed(unit != active_texture_)) {
+		GL_STATE_CALL(glActiveTexture(unit));
+		active_texture_ = unit;
+	}
+	GL_STATE_CALL(glBindTexture(target, texture));
+	bound->second = texture;
+}
+
+// Uniform values belong to the program, so they survive program switches.
+void
+GLState::uniform4fv(GLint location, GLsizei count, const GLfloat* values)
+{
+	std::vector<GLfloat>& shadow = uniforms_[std::make_pair(program_, location)];
+	size_t floats = size_t(count) * 4;
+	bool same = shadow.size() == floats &&
+	            memcmp(shadow.data(), values, floats * sizeof(GLfloat)) == 0;
+	if (!changed(!same))
+		return;
+	GL_STATE_CALL(glUniform4fv(location, count, values));
+	shadow.assign(values, values + floats);
+}
+
+void
+GLState::uniform1i(GLint location, GLint value)
+{
+	auto shadow = int_uniforms_.insert(std::make_pair(std::make_pair(program_, location),
+	                                                  value));
+	if (!changed(shadow.second || shadow.first->second != value))
+		return;
+	GL_STATE_CALL(glUniform1i(location, value));
+	shadow.first->second = value;
+}
+
+void
+GLState::set_capability(GLenum capability, bool enabled)
+{
+	auto state = capabilities_.insert(std::make_pair(capability, -1)).first;
+	if (!changed(state->second != int(enabled)))
+		return;
+	if (enabled)
+		GL_STATE_CALL(glEnable(capability));
+	else
+		GL_STATE_CALL(glDisable(capability));
+	state->second = enabled;
+}
+
+void
+GLState::depth_func(GLenum func)
+{
+	if (!changed(func != depth_func_))
+		return;
+	GL_STATE_CALL(glDepthFunc(func));
+	depth_func_ = func;
+}
+
+void
+GLState::clear_color(GLfloat r, GLfloat g, GLfloat b, GLfloat a)
+{
+	GLfloat color[4] = { r, g, b, a };
+	if (!changed(memcmp(color, clear_color_, sizeof(color)) != 0))
+		return;
+	GL_STATE_CALL(glClearColor(r, g, b, a));
+	memcpy(clear_color_, color, sizeof(color));
+}
+
+void
+GLState::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	GLint rect[4] = { x, y, width, height };
+	if (!changed(memcmp(rect, viewport_, sizeof(rect)) != 0))
+		return;
+	GL_STATE_CALL(glViewport(x, y, width, height));
+	memcpy(viewport_, rect, sizeof(rect));
+}
+
+void
+GLState::buffer_data(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+{
+	changed(true);
+	GL_STATE_CALL(glBufferData(target, size, data, usage));
+	// Only contents written with buffer_sub_data are shadowed, which keeps
+	// large vertex uploads from being copied.
+	buffer_contents_.erase(buffer_slot(target));
+}
+
+void
+GLState::buffer_sub_data(GLenum target, GLintptr offset, GLsizeiptr size,
+                         const void* data)
+{
+	std::vector<char>& shadow = buffer_contents_[buffer_slot(target)];
+	const char* bytes = static_cast<const char*>(data);
+	bool same = size_t(offset + size) <= shadow.size() &&
+	            memcmp(&shadow[offset], bytes, size) == 0;
+	if (!changed(!same))
+		return;
+	GL_STATE_CALL(glBufferSubData(target, offset, size, data));
+	if (shadow.size() < size_t(offset + size))
+		shadow.resize(offset + size);
+	memcpy(&shadow[offset], bytes, size);
+}
+
+void
+GLState::clear(GLbitfield mask)
+{
+	changed(true);
+	GL_STATE_CALL(glClear(mask));
+}
+
+void
+GLState::draw_arrays(GLenum mode, GLint first, GLsizei count)
+{
+	changed(true);
+	GL_STATE_CALL(glDrawArrays(mode, first, count));
+}
+
+void
+GLState::draw_elements(GLenum mode, GLsizei count, GLenum type, const void* indices)
+{
+	changed(true);
+	GL_STATE_CALL(glDrawElements(mode, count, type, indices));
+}
+
+void
+GLState::draw_elements_base_vertex(GLenum mode, GLsizei count, GLenum type,
+                                   const void* indices, GLint base_vertex)
+{
+	changed(true);
+	GL_STATE_CALL(glDrawElementsBaseVertex(mode, count, type, indices, base_vertex));
+}
+
+void
+GLState::multi_draw_elements_indirect(GLenum mode, GLenum type, const void* indirect,
+                                      GLsizei draw_count, GLsizei stride)
+{
+	changed(true);
+	GL_STATE_CALL(glMultiDrawElementsIndirect(mode, type, indirect, draw_count, stride));
+}
+
+void
+GLState::dispatch_compute(GLuint x, GLuint y, GLuint z)
+{
+	changed(true);
+	GL_STATE_CALL(glDispatchCompute(x, y, z));
+}
+
+void
+GLState::end_frame()
+{
+	last_frame_ = frame_;
+	total_.issued += frame_.issued;
+	total_.skipped += frame_.skipped;
+	frame_ = Counters();
+	frames_++;
+}
@@ -0,0 +1,92 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <GL/glew.h>
+#include <map>
+#include <vector>
+
+// Shadows the GL state the renderer touches and drops calls that would not
+// change it: vertex array, framebuffer, buffer and program bindings, depth
+// state, clear color, viewport, textures, uniforms and the contents of
+// small buffers such as the uniform block. Every call that goes through
+// here is counted as issued or skipped, per frame and in total.
+//
+// The shadow starts unknown, so the first call of each kind is always
+// issued. Code that changes this state behind the cache's back, or deletes
+// bound objects, must call invalidate(). Issued calls are not followed by
+// glGetError unless built with GL_STATE_CHECK_ERRORS.
+class GLState {
+public:
+	struct Counters {
+		unsigned long issued = 0;
+		unsigned long skipped = 0;
+	};
+
+	GLState();
+	void invalidate();
+
+	void bind_vertex_array(GLuint vao);
+	void bind_framebuffer(GLuint framebuffer);
+	// GL_ELEMENT_ARRAY_BUFFER is tracked per vertex array, as GL stores it.
+	void bind_buffer(GLenum target, GLuint buffer);
+	void bind_buffer_base(GLenum target, GLuint index, GLuint buffer);
+	void use_program(GLuint program);
+	void bind_texture(GLenum unit, GLenum target, GLuint texture);
+	// glUniform4fv for the current program, skipped when the values equal
+	// what was last set for that program and location.
+	void uniform4fv(GLint location, GLsizei count, const GLfloat* values);
+	void uniform1i(GLint location, GLint value);
+	void set_capability(GLenum capability, bool enabled);
+	void depth_func(GLenum func);
+	void clear_color(GLfloat r, GLfloat g, GLfloat b, GLfloat a);
+	void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+	// (Re)allocates the buffer bound to `target`. Always issued, and
+	// forgets the contents seen by buffer_sub_data.
+	void buffer_data(GLenum target, GLsizeiptr size, const void* data, GLenum usage);
+	// glBufferSubData on the buffer bound to `target`, skipped when the
+	// bytes equal what was last written through here.
+	void buffer_sub_data(GLenum target, GLintptr offset, GLsizeiptr size,
+	                     const void* data);
+
+	// Calls that are never redundant, counted so the totals cover the frame.
+	void clear(GLbitfield mask);
+	void draw_arrays(GLenum mode, GLint first, GLsizei count);
+	void draw_elements(GLenum mode, GLsizei count, GLenum type, const void* indices);
+	void draw_elements_base_vertex(GLenum mode, GLsizei count, GLenum type,
+	                               const void* indices, GLint base_vertex);
+	void multi_draw_elements_indirect(GLenum mode, GLenum type, const void* indirect,
+	                                  GLsizei draw_count, GLsizei stride);
+	void dispatch_compute(GLuint x, GLuint y, GLuint z);
+
+	// Closes the frame: the current counters become last_frame() and are
+	// added to total().
+	void end_frame();
+	const Counters& last_frame() const { return last_frame_; }
+	const Counters& total() const { return total_; }
+	unsigned long frames() const { return frames_; }
+private:
+	bool changed(bool differs);
+	GLuint& buffer_slot(GLenum target);
+
+	GLuint vertex_array_;
+	GLuint framebuffer_;
+	std::map<GLenum, GLuint> buffers_;
+	std::map<GLuint, GLuint> element_buffers_;  // per vertex array
+	std::map<GLuint, std::vector<char>> buffer_contents_;
+	GLuint program_;
+	GLenum active_texture_;
+	std::map<std::pair<GLenum, GLenum>, GLuint> textures_;  // by unit and target
+	std::map<std::pair<GLuint, GLint>, std::vector<GLfloat>> uniforms_;
+	std::map<std::pair<GLuint, GLint>, GLint> int_uniforms_;
+	std::map<GLenum, int> capabilities_;  // -1 unknown, 0 off, 1 on
+	GLenum depth_func_;
+	GLfloat clear_color_[4];
+	GLint viewport_[4];
+
+	Counters frame_;
+	Counters last_frame_;
+	Counters total_;
+	unsigned long frames_ = 0;
+};
+
+#endif
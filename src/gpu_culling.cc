@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <iostream>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <debuggl.h>
+#include "gl_state.h"
+#include "gpu_culling.h"
+
+namespace {
+	const GLuint kCullGroupSize = 64;    // local_size_x of the cull shader
+	const GLuint kReduceGroupSize = 8;   // local_size_x and _y of the reduction
+
+	// Shader storage bindings, as declared in the cull shader.
+	enum { kBoundsBinding, kCommandBinding, kVisibilityBinding };
+
+	// The layout glMultiDrawElementsIndirect reads.
+	struct DrawCommand {
+		GLuint count;
+		GLuint instance_count;
+		GLuint first_index;
+		GLint base_vertex;
+		GLuint base_instance;
+	};
+
+	GLuint groups(int items, GLuint group_size)
+	{
+		return (GLuint(items) + group_size - 1) / group_size;
+	}
+};
+
+bool
+GpuCuller::supported()
+{
+	return GLEW_VERSION_4_3;
+}
+
+GpuCuller::GpuCuller(GLState& gl, GLuint cull_program, GLuint reduce_program)
+	: gl_(gl), cull_program_(cull_program), reduce_program_(reduce_program)
+{
+	CHECK_GL_ERROR(phase_location_ = glGetUniformLocation(cull_program_, "phase"));
+	CHECK_GL_ERROR(source_level_location_ = glGetUniformLocation(reduce_program_,
+	                                                             "source_level"));
+	CHECK_GL_ERROR(glGenBuffers(1, &bounds_buffer_));
+	CHECK_GL_ERROR(glGenBuffers(2, command_buffers_));
+	CHECK_GL_ERROR(glGenBuffers(1, &visibility_buffer_));
+	CHECK_GL_ERROR(glGenFramebuffers(1, &framebuffer_));
+}
+
+GpuCuller::~GpuCuller()
+{
+	resize(0, 0);
+	gl_.bind_buffer(GL_SHADER_STORAGE_BUFFER, 0);
+	gl_.bind_buffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	CHECK_GL_ERROR(glDeleteBuffers(1, &bounds_buffer_));
+	CHECK_GL_ERROR(glDeleteBuffers(2, command_buffers_));
+	CHECK_GL_ERROR(glDeleteBuffers(1, &visibility_buffer_));
+	CHECK_GL_ERROR(glDeleteFramebuffers(1, &framebuffer_));
+}
+
+void
+GpuCuller::set_chunks(const std::vector<Menger::Chunk>& chunks)
+{
+	chunk_count_ = chunks.size();
+	std::vector<glm::vec4> bounds;
+	std::vector<DrawCommand> commands;
+	for (const Menger::Chunk& chunk : chunks) {
+		bounds.push_back(glm::vec4(chunk.min, 1.0f));
+		bounds.push_back(glm::vec4(chunk.max, 1.0f));
+		DrawCommand command = { GLuint(chunk.face_count * 3), 0,
+		                        GLuint(chunk.first_face * 3), 0, 0 };
+		commands.push_back(command);
+	}
+	// Every chunk starts visible, so the first frame draws it all in the
+	// first phase and sorts it out in the second.
+	std::vector<GLuint> visible(chunks.size(), 1);
+
+	gl_.bind_buffer(GL_SHADER_STORAGE_BUFFER, bounds_buffer_);
+	gl_.buffer_data(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * bounds.size(),
+	                bounds.data(), GL_STATIC_DRAW);
+	for (GLuint buffer : command_buffers_) {
+		gl_.bind_buffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		gl_.buffer_data(GL_SHADER_STORAGE_BUFFER, sizeof(DrawCommand) * commands.size(),
+		                commands.data(), GL_DYNAMIC_DRAW);
+	}
+	gl_.bind_buffer(GL_SHADER_STORAGE_BUFFER, visibility_buffer_);
+	gl_.buffer_data(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * visible.size(),
+	                visible.data(), GL_DYNAMIC_DRAW);
+}
+
+// Color goes to a renderbuffer and depth to a texture the reduction can
+// sample. The pyramid has a full chain of mip levels down to 1x1.
+void
+GpuCuller::resize(int width, int height)
+{
+	if (width == width_ && height == height_)
+		return;
+	gl_.bind_framebuffer(0);
+	gl_.bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, 0);
+	CHECK_GL_ERROR(glDeleteRenderbuffers(1, &color_renderbuffer_));
+	CHECK_GL_ERROR(glDeleteTextures(1, &depth_texture_));
+	CHECK_GL_ERROR(glDeleteTextures(1, &pyramid_));
+	color_renderbuffer_ = depth_texture_ = pyramid_ = 0;
+	width_ = width;
+	height_ = height;
+	if (width == 0 || height == 0)
+		return;
+
+	levels_ = 1;
+	while ((std::max(width, height) >> levels_) > 0)
+		levels_++;
+
+	CHECK_GL_ERROR(glGenRenderbuffers(1, &color_renderbuffer_));
+	CHECK_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, color_renderbuffer_));
+	CHECK_GL_ERROR(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height));
+	CHECK_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, 0));
+
+	CHECK_GL_ERROR(glGenTextures(1, &depth_texture_));
+	gl_.bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, depth_texture_);
+	CHECK_GL_ERROR(glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height));
+	CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+	CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+	CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE));
+
+	CHECK_GL_ERROR(glGenTextures(1, &pyramid_));
+	gl_.bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, pyramid_);
+	CHECK_GL_ERROR(glTexStorage2D(GL_TEXTURE_2D, levels_, GL_R32F, width, height));
+	CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+	                               GL_NEAREST_MIPMAP_NEAREST));
+	CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+
+	gl_.bind_framebuffer(framebuffer_);
+	CHECK_GL_ERROR(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+	                                         GL_RENDERBUFFER, color_renderbuffer_));
+	CHECK_GL_ERROR(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+	                                      GL_TEXTURE_2D, depth_texture_, 0));
+	GLenum status = GL_NONE;
+	CHECK_GL_ERROR(status = glCheckFramebufferStatus(GL_FRAMEBUFFER));
+	CHECK_SUCCESS(status == GL_FRAMEBUFFER_COMPLETE);
+}
+
+GLuint
+GpuCuller::bind_framebuffer(int width, int height)
+{
+	// A minimized window still gets a complete framebuffer.
+	resize(std::max(width, 1), std::max(height, 1));
+	gl_.bind_framebuffer(framebuffer_);
+	return framebuffer_;
+}
+
+// Writes the draw commands of `phase`, and in phase 1 the visibility the
+// next frame starts from.
+void
+GpuCuller::cull(int phase)
+{
+	gl_.use_program(cull_program_);
+	gl_.uniform1i(phase_location_, phase);
+	gl_.bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, pyramid_);
+	gl_.bind_buffer_base(GL_SHADER_STORAGE_BUFFER, kBoundsBinding, bounds_buffer_);
+	gl_.bind_buffer_base(GL_SHADER_STORAGE_BUFFER, kCommandBinding,
+	                     command_buffers_[phase]);
+	gl_.bind_buffer_base(GL_SHADER_STORAGE_BUFFER, kVisibilityBinding,
+	                     visibility_buffer_);
+	gl_.dispatch_compute(groups(chunk_count_, kCullGroupSize), 1, 1);
+	CHECK_GL_ERROR(glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT));
+}
+
+// Level 0 is a copy of the depth buffer; each further level keeps the
+// farthest depth of the texels it covers in the level above.
+void
+GpuCuller::build_pyramid()
+{
+	gl_.use_program(reduce_program_);
+	for (int level = 0; level < levels_; level++) {
+		int width = std::max(width_ >> level, 1);
+		int height = std::max(height_ >> level, 1);
+		if (level == 0) {
+			gl_.bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, depth_texture_);
+			gl_.uniform1i(source_level_location_, 0);
+		} else {
+			gl_.bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, pyramid_);
+			gl_.uniform1i(source_level_location_, level - 1);
+		}
+		CHECK_GL_ERROR(glBindImageTexture(0, pyramid_, level, GL_FALSE, 0,
+		                                  GL_WRITE_ONLY, GL_R32F));
+		gl_.dispatch_compute(groups(width, kReduceGroupSize),
+		                     groups(height, kReduceGroupSize), 1);
+		CHECK_GL_ERROR(glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT));
+	}
+}
+
+void
+GpuCuller::draw(GLuint vertex_array, GLuint program)
+{
+	if (chunk_count_ == 0)
+		return;
+	for (int phase = 0; phase < 2; phase++) {
+		if (phase == 1)
+			build_pyramid();
+		cull(phase);
+		gl_.bind_vertex_array(vertex_array);
+		gl_.use_program(program);
+		gl_.bind_buffer(GL_DRAW_INDIRECT_BUFFER, command_buffers_[phase]);
+		gl_.multi_draw_elements_indirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr,
+		                                 chunk_count_, 0);
+	}
+}
+
+void
+GpuCuller::present()
+{
+	// The cache binds draw and read framebuffers together, so only the
+	// draw binding is moved here and bind_framebuffer(0) restores both.
+	gl_.bind_framebuffer(framebuffer_);
+	CHECK_GL_ERROR(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0));
+	CHECK_GL_ERROR(glBlitFramebuffer(0, 0, width_, height_, 0, 0, width_, height_,
+	                                 GL_COLOR_BUFFER_BIT, GL_NEAREST));
+	gl_.bind_framebuffer(0);
+}
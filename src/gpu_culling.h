@@ -0,0 +1,67 @@
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include <vector>
+#include <GL/glew.h>
+#include "menger.h"
+
+class GLState;
+
+// Culls chunks of the sponge on the GPU and draws the rest with indirect
+// multi-draws, so the CPU issues the same few calls at any level.
+//
+// The chunk bounds live in a shader storage buffer. A compute shader tests
+// them against the frustum and a depth pyramid, whose texels hold the
+// farthest depth below them, and writes one draw command per chunk with an
+// instance count of 0 or 1. Each frame runs in two phases. The first draws
+// the chunks that were visible last frame and are still in the frustum.
+// The pyramid is then built from that depth, and the second phase draws
+// whatever else passes against it. Its results seed the next frame, and a
+// chunk coming into view is drawn in the frame it appears.
+//
+// The frame must be rendered into framebuffer(), whose depth can be read
+// back as a texture; present() copies it to the window.
+class GpuCuller {
+public:
+	// Whether the context has compute shaders and indirect multi-draws
+	// (GL 4.3).
+	static bool supported();
+
+	// `cull_program` and `reduce_program` are the compute shaders in main.cc.
+	GpuCuller(GLState& gl, GLuint cull_program, GLuint reduce_program);
+	~GpuCuller();
+
+	void set_chunks(const std::vector<Menger::Chunk>& chunks);
+
+	// The framebuffer to render the frame into, bound and sized to
+	// width x height.
+	GLuint bind_framebuffer(int width, int height);
+	// Draws the visible chunks with `vertex_array` and `program`, whose
+	// 32-bit indices must be in generation order. Occluders other than the
+	// sponge must already be drawn.
+	void draw(GLuint vertex_array, GLuint program);
+	// Copies the frame to the window and binds the window's framebuffer.
+	void present();
+private:
+	void cull(int phase);
+	void build_pyramid();
+	void resize(int width, int height);
+
+	GLState& gl_;
+	GLuint cull_program_, reduce_program_;
+	GLint phase_location_, source_level_location_;
+
+	GLuint bounds_buffer_ = 0;
+	GLuint command_buffers_[2] = { 0, 0 };  // one per phase
+	GLuint visibility_buffer_ = 0;
+	GLsizei chunk_count_ = 0;
+
+	GLuint framebuffer_ = 0;
+	GLuint color_renderbuffer_ = 0;
+	GLuint depth_texture_ = 0;
+	GLuint pyramid_ = 0;
+	int width_ = 0, height_ = 0;
+	int levels_ = 0;
+};
+
+#endif
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <debuggl.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include "gl_state.h"
+#include "impostor.h"
+
+namespace {
+	const int kMaxAtlasColumns = 16;
+
+	// Half the diagonal of the chunk's box.
+	float bounding_radius(const Menger::Chunk& chunk)
+	{
+		return 0.5f * glm::length(chunk.max - chunk.min);
+	}
+
+	glm::vec3 center(const Menger::Chunk& chunk)
+	{
+		return 0.5f * (chunk.min + chunk.max);
+	}
+};
+
+ImpostorCache::ImpostorCache(GLState& gl, GLuint program, const Settings& settings)
+	: gl_(gl), program_(program), settings_(settings)
+{
+	CHECK_GL_ERROR(center_location_ = glGetUniformLocation(program_, "impostor_center"));
+	CHECK_GL_ERROR(axes_location_ = glGetUniformLocation(program_, "impostor_axes"));
+	CHECK_GL_ERROR(forward_location_ = glGetUniformLocation(program_, "impostor_forward"));
+	CHECK_GL_ERROR(rect_location_ = glGetUniformLocation(program_, "impostor_rect"));
+	GLint color_sampler = 0, depth_sampler = 0;
+	CHECK_GL_ERROR(color_sampler = glGetUniformLocation(program_, "impostor_color"));
+	CHECK_GL_ERROR(depth_sampler = glGetUniformLocation(program_, "impostor_depth"));
+	gl_.use_program(program_);
+	CHECK_GL_ERROR(glUniform1i(color_sampler, 0));
+	CHECK_GL_ERROR(glUniform1i(depth_sampler, 1));
+
+	CHECK_GL_ERROR(glGenVertexArrays(1, &vertex_array_));
+	CHECK_GL_ERROR(glGenFramebuffers(1, &framebuffer_));
+	CHECK_GL_ERROR(glGenTextures(1, &color_texture_));
+	CHECK_GL_ERROR(glGenTextures(1, &depth_texture_));
+}
+
+ImpostorCache::~ImpostorCache()
+{
+	gl_.bind_framebuffer(0);
+	gl_.bind_vertex_array(0);
+	gl_.bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, 0);
+	gl_.bind_texture(GL_TEXTURE1, GL_TEXTURE_2D, 0);
+	CHECK_GL_ERROR(glDeleteTextures(1, &color_texture_));
+	CHECK_GL_ERROR(glDeleteTextures(1, &depth_texture_));
+	CHECK_GL_ERROR(glDeleteFramebuffers(1, &framebuffer_));
+	CHECK_GL_ERROR(glDeleteVertexArrays(1, &vertex_array_));
+}
+
+void
+ImpostorCache::set_chunks(const std::vector<Menger::Chunk>& chunks)
+{
+	chunks_ = chunks;
+	View unused = { glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f), 0, false };
+	views_.assign(chunks_.size() * settings_.views, unused);
+	slot_of_.assign(chunks_.size(), -1);
+
+	// One capture per atlas cell, chunk after chunk. The atlas must fit the
+	// driver's texture size: use fewer columns first, then smaller captures.
+	GLint max_size = 0;
+	CHECK_GL_ERROR(glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size));
+	int slots = std::max<int>(views_.size(), 1);
+	int resolution = std::min(settings_.resolution, int(max_size));
+	int rows;
+	for (;;) {
+		atlas_columns_ = std::min(std::min(slots, kMaxAtlasColumns),
+		                          int(max_size) / resolution);
+		rows = (slots + atlas_columns_ - 1) / atlas_columns_;
+		if (rows * resolution <= max_size || resolution == 1)
+			break;
+		resolution /= 2;
+	}
+	if (resolution != settings_.resolution) {
+		std::cerr << "Impostor captures reduced to " << resolution << "^2 texels"
+		          << " to fit the atlas in " << max_size << "^2\n";
+		settings_.resolution = resolution;
+	}
+	int width = atlas_columns_ * settings_.resolution;
+	int height = rows * settings_.resolution;
+
+	// Color is sampled like depth, texel by texel: filtering would blend the
+	// silhouette with the black clear color, and alpha is not coverage.
+	gl_.bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, color_texture_);
+	CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0,
+	                            GL_RGBA, GL_UNSIGNED_BYTE, nullptr));
+	CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+	CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+	CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+	CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+	gl_.bind_texture(GL_TEXTURE1, GL_TEXTURE_2D, depth_texture_);
+	CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0,
+	                            GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr));
+	CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+	CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+	CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE));
+
+	gl_.bind_framebuffer(framebuffer_);
+	CHECK_GL_ERROR(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+	                                      GL_TEXTURE_2D, color_texture_, 0));
+	CHECK_GL_ERROR(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+	                                      GL_TEXTURE_2D, depth_texture_, 0));
+	GLenum status = GL_NONE;
+	CHECK_GL_ERROR(status = glCheckFramebufferStatus(GL_FRAMEBUFFER));
+	CHECK_SUCCESS(status == GL_FRAMEBUFFER_COMPLETE);
+	gl_.bind_framebuffer(0);
+}
+
+// Texture coordinates of a capture, from its first texel center to its
+// last, so no sample lands in the neighboring capture.
+glm::vec4
+ImpostorCache::atlas_rect(int slot) const
+{
+	int rows = (views_.size() + atlas_columns_ - 1) / atlas_columns_;
+	float width = float(atlas_columns_ * settings_.resolution);
+	float height = float(rows * settings_.resolution);
+	float x = (slot % atlas_columns_) * settings_.resolution;
+	float y = (slot / atlas_columns_) * settings_.resolution;
+	return glm::vec4((x + 0.5f) / width, (y + 0.5f) / height,
+	                 (settings_.resolution - 1.0f) / width,
+	                 (settings_.resolution - 1.0f) / height);
+}
+
+void
+ImpostorCache::update(const glm::vec3& eye, float fovy, int viewport_height,
+                      const DrawChunk& draw_chunk)
+{
+	frame_++;
+	float cos_max_angle = std::cos(glm::radians(settings_.max_angle));
+	float pixels_per_unit = 0.5f * viewport_height / std::tan(0.5f * fovy);
+	for (size_t i = 0; i < chunks_.size(); i++) {
+		slot_of_[i] = -1;
+		float radius = bounding_radius(chunks_[i]);
+		glm::vec3 offset = eye - center(chunks_[i]);
+		float distance = glm::length(offset);
+		// Up close a flat quad is a poor stand-in however it is textured.
+		if (distance < 3.0f * radius)
+			continue;
+		float screen_diameter = 2.0f * radius * pixels_per_unit / distance;
+		if (screen_diameter > settings_.resolution)
+			continue;
+
+		glm::vec3 direction = offset / distance;
+		View* views = &views_[i * settings_.views];
+		int best = -1;
+		float best_cos = -2.0f;
+		for (int v = 0; v < settings_.views; v++) {
+			if (!views[v].valid)
+				continue;
+			float c = glm::dot(views[v].direction, direction);
+			if (c > best_cos) {
+				best_cos = c;
+				best = v;
+			}
+		}
+		if (best < 0 || best_cos < cos_max_angle) {
+			// Replace an empty view, else the least recently used one.
+			best = 0;
+			for (int v = 1; v < settings_.views; v++) {
+				if (!views[best].valid)
+					break;
+				if (!views[v].valid || views[v].last_used < views[best].last_used)
+					best = v;
+			}
+			capture(i, best, direction, draw_chunk);
+		}
+		views[best].last_used = frame_;
+		slot_of_[i] = best;
+	}
+}
+
+// Renders the chunk into its atlas cell with an orthographic camera that
+// looks at its center from `direction` and just encloses its bounding
+// sphere: depth 0 is one radius in front of the center, depth 1 one
+// radius behind.
+void
+ImpostorCache::capture(size_t chunk, int slot, const glm::vec3& direction,
+                       const DrawChunk& draw_chunk)
+{
+	const Menger::Chunk& c = chunks_[chunk];
+	float radius = bounding_radius(c);
+	glm::vec3 target = center(c);
+	glm::vec3 up_hint = std::abs(direction.y) < 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f)
+	                                                  : glm::vec3(0.0f, 0.0f, 1.0f);
+	View& view = views_[chunk * settings_.views + slot];
+	view.direction = direction;
+	view.right = glm::normalize(glm::cross(-direction, up_hint));
+	view.up = glm::cross(view.right, -direction);
+	view.valid = true;
+
+	int cell = chunk * settings_.views + slot;
+	int x = (cell % atlas_columns_) * settings_.resolution;
+	int y = (cell / atlas_columns_) * settings_.resolution;
+	gl_.bind_framebuffer(framebuffer_);
+	gl_.viewport(x, y, settings_.resolution, settings_.resolution);
+	gl_.set_capability(GL_SCISSOR_TEST, true);
+	CHECK_GL_ERROR(glScissor(x, y, settings_.resolution, settings_.resolution));
+	gl_.set_capability(GL_DEPTH_TEST, true);
+	gl_.clear_color(0.0f, 0.0f, 0.0f, 0.0f);
+	gl_.clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius,
+	                                  radius, 3.0f * radius);
+	glm::mat4 look = glm::lookAt(target + 2.0f * radius * direction, target, up_hint);
+	draw_chunk(c, projection, look);
+
+	gl_.set_capability(GL_SCISSOR_TEST, false);
+	gl_.bind_framebuffer(0);
+	captures_++;
+}
+
+void
+ImpostorCache::draw()
+{
+	gl_.use_program(program_);
+	gl_.bind_vertex_array(vertex_array_);
+	gl_.bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, color_texture_);
+	gl_.bind_texture(GL_TEXTURE1, GL_TEXTURE_2D, depth_texture_);
+	for (size_t i = 0; i < chunks_.size(); i++) {
+		if (slot_of_[i] < 0)
+			continue;
+		const View& view = views_[i * settings_.views + slot_of_[i]];
+		glm::vec4 center_radius(center(chunks_[i]), bounding_radius(chunks_[i]));
+		glm::vec4 axes[2] = { glm::vec4(view.right, 0.0f), glm::vec4(view.up, 0.0f) };
+		glm::vec4 forward(view.direction, 0.0f);
+		glm::vec4 rect = atlas_rect(i * settings_.views + slot_of_[i]);
+		gl_.uniform4fv(center_location_, 1, &center_radius[0]);
+		gl_.uniform4fv(axes_location_, 2, &axes[0][0]);
+		gl_.uniform4fv(forward_location_, 1, &forward[0]);
+		gl_.uniform4fv(rect_location_, 1, &rect[0]);
+		gl_.draw_arrays(GL_TRIANGLE_STRIP, 0, 4);
+	}
+}
@@ -0,0 +1,88 @@
+#ifndef IMPOSTOR_H
+#define IMPOSTOR_H
+
+#include <functional>
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "menger.h"
+
+class GLState;
+
+// Stands in for distant chunks of the sponge with textured quads.
+//
+// A chunk becomes an impostor once its bounding sphere spans fewer pixels
+// than an impostor texture, so texels are never magnified on screen. Each
+// chunk keeps a few captures (color and depth) taken from the directions it
+// was seen from, in one atlas. A capture is reused while the direction to
+// the camera stays within the angle threshold; past it, the chunk's least
+// recently used capture is rendered again from the new direction. The quad
+// writes the captured depth, so impostors intersect the floor and each
+// other correctly.
+class ImpostorCache {
+public:
+	static const int kMaxResolution = 4096;
+	struct Settings {
+		// Texels per side of one capture. Reduced if the atlas would not
+		// fit the driver's texture size.
+		int resolution = 128;
+		int views = 4;            // captures kept per chunk
+		float max_angle = 5.0f;   // degrees before a capture is redone
+	};
+	// Draws the faces of one chunk with the given camera into the bound
+	// framebuffer and viewport.
+	typedef std::function<void(const Menger::Chunk& chunk, const glm::mat4& projection,
+	                           const glm::mat4& view)> DrawChunk;
+
+	// `program` draws impostor quads, see the shaders in main.cc.
+	ImpostorCache(GLState& gl, GLuint program, const Settings& settings);
+	~ImpostorCache();
+
+	// Drops every capture and starts over with new chunks.
+	void set_chunks(const std::vector<Menger::Chunk>& chunks);
+	const std::vector<Menger::Chunk>& chunks() const { return chunks_; }
+
+	// Chooses geometry or impostor for every chunk as seen from `eye`, with
+	// a vertical field of view `fovy` (radians) over `viewport_height`
+	// pixels, and renders the captures that are missing or off by more
+	// than the angle threshold. Leaves the framebuffer and viewport to the
+	// caller.
+	void update(const glm::vec3& eye, float fovy, int viewport_height,
+	            const DrawChunk& draw_chunk);
+	// Whether chunk i was left to be drawn as geometry by update().
+	bool draws_geometry(size_t i) const { return slot_of_[i] < 0; }
+	// Draws the impostors chosen by update(). The frame uniforms must
+	// already hold the camera.
+	void draw();
+
+	unsigned long captures() const { return captures_; }
+private:
+	struct View {
+		glm::vec3 direction;  // from the chunk's center toward the camera
+		glm::vec3 right, up;
+		unsigned long last_used;
+		bool valid;
+	};
+
+	void capture(size_t chunk, int slot, const glm::vec3& direction,
+	             const DrawChunk& draw_chunk);
+	glm::vec4 atlas_rect(int slot) const;
+
+	GLState& gl_;
+	GLuint program_;
+	Settings settings_;
+	GLint center_location_, axes_location_, forward_location_, rect_location_;
+
+	GLuint framebuffer_ = 0;
+	GLuint color_texture_ = 0, depth_texture_ = 0;
+	GLuint vertex_array_ = 0;  // empty; quads come from gl_VertexID
+	int atlas_columns_ = 0;
+
+	std::vector<Menger::Chunk> chunks_;
+	std::vector<View> views_;     // settings_.views per chunk
+	std::vector<int> slot_of_;    // view used this frame, -1 for geometry
+	unsigned long frame_ = 0;
+	unsigned long captures_ = 0;
+};
+
+#endif
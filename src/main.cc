@@ -1,8 +1,14 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <memory>
+#include <sstream>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -14,6 +20,14 @@
 #include <debuggl.h>
 #include "menger.h"
 #include "camera.h"
+#include "gl_state.h"
+#include "gpu_culling.h"
+#include "impostor.h"
+#include "profiler.h"
+#include "program_cache.h"
+#include "tiled_capture.h"
+#include "mesh_optimizer.h"
+#include "validation.h"
 
 int window_width = 800, window_height = 600;
 
@@ -26,18 +40,97 @@ enum { kGeometryVao, kFloorVao, kNumVaos };
 GLuint g_array_objects[kNumVaos];  // This will store the VAO descriptors.
 GLuint g_buffer_objects[kNumVaos][kNumVbos];  // These will store VBO descriptors.
 
+// Per-frame data shared by every program through one uniform buffer. The
+// layout must match the std140 FrameUniforms block in the shaders.
+struct FrameUniforms {
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::vec4 light_position;
+};
+const GLuint kFrameUniformBinding = 0;
+GLuint g_frame_uniform_buffer;
+
+// All binds, state changes and draws go through here to skip redundant ones.
+GLState g_gl;
+
+// Command line switches.
+struct Options {
+	// Build the sponge in std::vectors and copy it with glBufferData instead
+	// of generating straight into mapped buffers. Kept for comparison.
+	bool copy_upload = false;
+	// Reorder the sponge for the post-transform vertex cache and for linear
+	// vertex fetch. Implies a CPU-side copy.
+	bool optimize_mesh = false;
+	// Draw the sponge with 16-bit indices, split into base-vertex ranges.
+	// Implies a CPU-side copy.
+	bool index16 = false;
+	// Levels whose buffers would exceed this many bytes are refused.
+	uint64_t memory_budget = 1024ull << 20;
+	// Redraw every iteration instead of only when something changed. For
+	// benchmarks.
+	bool continuous = false;
+	// Size, tile size and file of the offscreen capture taken with P.
+	CaptureSettings capture;
+	// Emit all six faces of every leaf cube instead of meshing only the
+	// surface of the voxel grid. Kept for comparison.
+	bool cube_soup = false;
+	// Draw distant top-level cells of the sponge as textured quads. Needs
+	// the faces in generation order, so not with --optimize-mesh or
+	// --index16.
+	bool impostors = false;
+	ImpostorCache::Settings impostor;
+	// Cull chunks of the sponge in a compute shader and draw them with
+	// indirect multi-draws. Needs GL 4.3 and the same face order as
+	// impostors; falls back to plain draws without either.
+	bool gpu_culling = false;
+	// Time the stages of each frame; print a summary at exit and keep the
+	// frame times in the window title. A non-empty trace path also writes
+	// a Chrome trace there.
+	bool profile = false;
+	std::string trace_path;
+	// Upload positions only and derive normals in the fragment shaders,
+	// halving the vertex data.
+	bool no_normals = false;
+};
+Options g_options;
+
+// How to draw what upload_menger left in the geometry buffers.
+struct MeshDraw {
+	GLenum index_type;
+	std::vector<IndexRange> ranges;
+	// Face ranges of the chunks, recorded as the sponge was generated.
+	// They only hold while the faces stay in generation order.
+	std::vector<Menger::Chunk> chunks;
+};
+
+// What draw_scene draws; the camera comes from the frame uniforms.
+struct Scene {
+	GLuint program_id;
+	GLuint floor_program_id;
+	MeshDraw menger_draw;
+	GLsizei floor_index_count;
+	ImpostorCache* impostors;  // null unless --impostors
+	GpuCuller* culler;         // null unless --gpu-culling
+};
+
 // C++ 11 String Literal
 // See http://en.cppreference.com/w/cpp/language/string_literal
 const char* vertex_shader =
 R"zzz(#version 330 core
 in vec4 vertex_position;
+#ifndef DERIVED_NORMALS
 in vec4 vertex_normal;
-uniform mat4 view;
-uniform mat4 projection;
-uniform vec4 light_position;
+#endif
+layout(std140) uniform FrameUniforms {
+	mat4 projection;
+	mat4 view;
+	vec4 light_position;
+};
 out vec4 light_direction;
+#ifndef DERIVED_NORMALS
 out vec4 normal;
 out vec4 world_normal;
+#endif
 out vec4 world_position;
 void main()
 {
@@ -47,20 +140,34 @@ void main()
 // Lighting in camera coordinates
 //  Compute light direction and transform to camera coordinates
         light_direction = view * (light_position - vertex_position);
+#ifndef DERIVED_NORMALS
 //  Transform normal to camera coordinates
         normal = view * vertex_normal;
         world_normal = vertex_normal;
+#endif
 }
 )zzz";
 
 const char* fragment_shader =
 R"zzz(#version 330 core
+layout(std140) uniform FrameUniforms {
+	mat4 projection;
+	mat4 view;
+	vec4 light_position;
+};
+#ifndef DERIVED_NORMALS
 in vec4 normal;
-in vec4 light_direction;
 in vec4 world_normal;
+#endif
+in vec4 light_direction;
+in vec4 world_position;
 out vec4 fragment_color;
 void main()
 {
+#ifdef DERIVED_NORMALS
+    vec4 world_normal = derived_normal(world_position);
+    vec4 normal = view * world_normal;
+#endif
     vec4 color = vec4(1.0*world_normal.x, 1.0*world_normal.y, 1.0*world_normal.z, 1.0);
     float dot_nl = dot(normalize(light_direction), normalize(normal));
     dot_nl = clamp(dot_nl, 0.0, 1.0);
@@ -68,16 +175,213 @@ void main()
 }
 )zzz";
 
+// Impostor quads, one per distant chunk, spanned from gl_VertexID. They
+// face the direction the capture was taken from and write the captured
+// depth, moved back into the scene's depth range.
+const char* impostor_vertex_shader =
+R"zzz(#version 330 core
+layout(std140) uniform FrameUniforms {
+	mat4 projection;
+	mat4 view;
+	vec4 light_position;
+};
+uniform vec4 impostor_center;   // xyz center, w radius
+uniform vec4 impostor_axes[2];  // right and up of the capture
+uniform vec4 impostor_rect;     // the capture in the atlas
+out vec2 uv;
+out vec3 quad_position;
+void main()
+{
+	vec2 corner = vec2((gl_VertexID & 1) != 0 ? 1.0 : -1.0,
+	                   (gl_VertexID & 2) != 0 ? 1.0 : -1.0);
+	quad_position = impostor_center.xyz + impostor_center.w *
+		(corner.x * impostor_axes[0].xyz + corner.y * impostor_axes[1].xyz);
+	uv = impostor_rect.xy + (corner * 0.5 + 0.5) * impostor_rect.zw;
+	gl_Position = projection * view * vec4(quad_position, 1.0);
+}
+)zzz";
+
+const char* impostor_fragment_shader =
+R"zzz(#version 330 core
+layout(std140) uniform FrameUniforms {
+	mat4 projection;
+	mat4 view;
+	vec4 light_position;
+};
+uniform vec4 impostor_center;
+uniform vec4 impostor_forward;
+uniform sampler2D impostor_color;
+uniform sampler2D impostor_depth;
+in vec2 uv;
+in vec3 quad_position;
+out vec4 fragment_color;
+void main()
+{
+	float depth = texture(impostor_depth, uv).r;
+	if (depth >= 1.0)
+		discard;
+	// Captured depth runs linearly from one radius in front of the
+	// center to one radius behind it.
+	vec3 surface = quad_position +
+		impostor_forward.xyz * impostor_center.w * (1.0 - 2.0 * depth);
+	vec4 clip = projection * view * vec4(surface, 1.0);
+	gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+	fragment_color = texture(impostor_color, uv);
+}
+)zzz";
+
+// Tests each chunk's box against the frustum and, in phase 1, against the
+// depth pyramid, and sets the instance count of its draw command. See
+// GpuCuller for the phases.
+const char* cull_compute_shader =
+R"zzz(#version 430 core
+layout(local_size_x = 64) in;
+layout(std140) uniform FrameUniforms {
+	mat4 projection;
+	mat4 view;
+	vec4 light_position;
+};
+struct DrawCommand {
+	uint count;
+	uint instance_count;
+	uint first_index;
+	int base_vertex;
+	uint base_instance;
+};
+layout(std430, binding = 0) readonly buffer ChunkBounds {
+	vec4 bounds[];  // min and max of each chunk
+};
+layout(std430, binding = 1) writeonly buffer DrawCommands {
+	DrawCommand commands[];
+};
+layout(std430, binding = 2) buffer Visibility {
+	uint visible[];
+};
+uniform int phase;
+uniform sampler2D depth_pyramid;
+
+// Farthest depth in the pyramid over a screen rectangle, from the level
+// where it spans about two texels.
+float farthest_depth(vec2 lo, vec2 hi)
+{
+	vec2 extent = (hi - lo) * vec2(textureSize(depth_pyramid, 0));
+	int level = int(ceil(log2(max(max(extent.x, extent.y), 1.0))));
+	level = clamp(level, 0, textureQueryLevels(depth_pyramid) - 1);
+	ivec2 size = textureSize(depth_pyramid, level);
+	ivec2 first = clamp(ivec2(lo * vec2(size)), ivec2(0), size - 1);
+	ivec2 last = clamp(ivec2(hi * vec2(size)), ivec2(0), size - 1);
+	float depth = 0.0;
+	for (int y = first.y; y <= last.y; y++)
+		for (int x = first.x; x <= last.x; x++)
+			depth = max(depth, texelFetch(depth_pyramid, ivec2(x, y), level).r);
+	return depth;
+}
+
+void main()
+{
+	uint i = gl_GlobalInvocationID.x;
+	if (i >= uint(visible.length()))
+		return;
+	vec3 lo = bounds[2 * i].xyz;
+	vec3 hi = bounds[2 * i + 1].xyz;
+	mat4 view_projection = projection * view;
+	vec4 corners[8];
+	for (int c = 0; c < 8; c++) {
+		vec3 p = vec3((c & 1) != 0 ? hi.x : lo.x,
+		              (c & 2) != 0 ? hi.y : lo.y,
+		              (c & 4) != 0 ? hi.z : lo.z);
+		corners[c] = view_projection * vec4(p, 1.0);
+	}
+
+	// Outside when every corner is past the same clip plane.
+	bool inside = true;
+	for (int axis = 0; axis < 3; axis++) {
+		bool below = true, above = true;
+		for (int c = 0; c < 8; c++) {
+			below = below && corners[c][axis] < -corners[c].w;
+			above = above && corners[c][axis] > corners[c].w;
+		}
+		inside = inside && !below && !above;
+	}
+
+	bool was_visible = visible[i] != 0u;
+	bool draw;
+	if (phase == 0) {
+		draw = inside && was_visible;
+	} else {
+		// Boxes reaching behind the eye are never occluded.
+		bool in_front = true;
+		vec2 screen_lo = vec2(1.0), screen_hi = vec2(0.0);
+		float nearest = 1.0;
+		for (int c = 0; c < 8; c++) {
+			if (corners[c].w <= 0.0) {
+				in_front = false;
+				break;
+			}
+			vec3 ndc = corners[c].xyz / corners[c].w;
+			screen_lo = min(screen_lo, ndc.xy * 0.5 + 0.5);
+			screen_hi = max(screen_hi, ndc.xy * 0.5 + 0.5);
+			nearest = min(nearest, ndc.z * 0.5 + 0.5);
+		}
+		bool passes = inside;
+		if (passes && in_front)
+			passes = nearest <= farthest_depth(clamp(screen_lo, 0.0, 1.0),
+			                                   clamp(screen_hi, 0.0, 1.0));
+		// Phase 0 already drew what was visible and in the frustum.
+		draw = passes && !was_visible;
+		visible[i] = passes ? 1u : 0u;
+	}
+	commands[i].instance_count = draw ? 1u : 0u;
+}
+)zzz";
+
+// Writes one level of the depth pyramid: the farthest depth of the source
+// texels each destination texel covers.
+const char* reduce_compute_shader =
+R"zzz(#version 430 core
+layout(local_size_x = 8, local_size_y = 8) in;
+layout(r32f, binding = 0) writeonly uniform image2D destination;
+uniform sampler2D source;  // the depth buffer, or the level above
+uniform int source_level;
+void main()
+{
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(destination);
+	if (texel.x >= size.x || texel.y >= size.y)
+		return;
+	// Sizes round down, so a texel may also cover an odd last row or
+	// column of the source.
+	ivec2 source_size = textureSize(source, source_level);
+	ivec2 first = texel * source_size / size;
+	ivec2 last = ((texel + 1) * source_size + size - 1) / size - 1;
+	float depth = 0.0;
+	for (int y = first.y; y <= last.y; y++)
+		for (int x = first.x; x <= last.x; x++)
+			depth = max(depth, texelFetch(source, ivec2(x, y), source_level).r);
+	imageStore(destination, texel, vec4(depth));
+}
+)zzz";
+
 // FIXME: Implement shader effects with an alternative shader.
 const char* floor_fragment_shader =
 R"zzz(#version 330 core
+layout(std140) uniform FrameUniforms {
+	mat4 projection;
+	mat4 view;
+	vec4 light_position;
+};
+#ifndef DERIVED_NORMALS
 in vec4 normal;
+#endif
 in vec4 light_direction;
 in vec4 world_position;
 out vec4 fragment_color;
 
 void main()
 {
+#ifdef DERIVED_NORMALS
+    vec4 normal = view * derived_normal(world_position);
+#endif
     vec4 color = vec4(0.0, 0.0, 0.0, 1.0);
     vec4 modded_coord = mod(world_position, vec4(0.5));
     if(modded_coord.x > 0.25) {
@@ -100,6 +404,29 @@ void main()
 }
 )zzz";
 
+// Prepended to the shaders above for --no-normals. Every face is an
+// axis-aligned quad lit with the positive normal of its axis, so the
+// normal is the axis the face's screen-space tangents do not span.
+const char* derived_normals_header = R"zzz(#define DERIVED_NORMALS
+)zzz";
+const char* derived_normal_function = R"zzz(
+vec4 derived_normal(vec4 position)
+{
+    vec3 n = abs(cross(dFdx(position.xyz), dFdy(position.xyz)));
+    if (n.x > n.y && n.x > n.z)
+        return vec4(1.0, 0.0, 0.0, 0.0);
+    return n.y > n.z ? vec4(0.0, 1.0, 0.0, 0.0) : vec4(0.0, 0.0, 1.0, 0.0);
+}
+)zzz";
+
+// `source` with `text` inserted after its #version line.
+std::string shader_variant(const char* source, const std::string& text)
+{
+	std::string result = source;
+	result.insert(result.find('\n') + 1, text);
+	return result;
+}
+
 void
 ErrorCallback(int error, const char* description)
 {
@@ -108,6 +435,183 @@ ErrorCallback(int error, const char* description)
 
 std::shared_ptr<Menger> g_menger;
 Camera g_camera;
+bool g_redraw = true;  // Camera, window or scene changed since the last frame.
+bool g_capture_requested = false;
+
+// Bytes a level needs while it is uploaded: its GL buffers, plus the
+// CPU-side copy on the paths that build one.
+uint64_t required_bytes(const Menger::Capacity& capacity)
+{
+	bool cpu_copy = g_options.copy_upload || g_options.optimize_mesh || g_options.index16;
+	uint64_t gpu = capacity.bytes[g_options.index16 ? Menger::kIndex16 : Menger::kIndex32];
+	if (g_options.no_normals)
+		gpu -= capacity.normal_bytes;
+	return cpu_copy ? gpu + capacity.bytes[Menger::kIndex32] : gpu;
+}
+
+// Reads a whole, positive number of megabytes as bytes, clamped so it
+// cannot overflow. Returns 0 for anything else.
+uint64_t parse_megabytes(const char* text)
+{
+	char* end = nullptr;
+	unsigned long long megabytes = strtoull(text, &end, 10);
+	if (end == text || *end != '\0' || strchr(text, '-') || megabytes == 0)
+		return 0;
+	const unsigned long long kMaxMegabytes = ~0ull >> 20;
+	return uint64_t(megabytes < kMaxMegabytes ? megabytes : kMaxMegabytes) << 20;
+}
+
+// Switches the sponge to `pattern` at `level` unless that would exceed the
+// memory budget. No geometry is generated to decide.
+bool select_sponge(Menger::Pattern pattern, int level)
+{
+	uint64_t required = required_bytes(g_menger->capacity(pattern, level));
+	if (required > g_options.memory_budget) {
+		std::cerr << "Refusing level " << level << ": needs "
+		          << (required >> 20) << " MB, budget is "
+		          << (g_options.memory_budget >> 20) << " MB\n";
+		return false;
+	}
+	if (pattern != g_menger->pattern())
+		g_menger->set_pattern(pattern);
+	if (level != g_menger->nesting_level())
+		g_menger->set_nesting_level(level);
+	return true;
+}
+
+void print_capacity_table(int max_level)
+{
+	std::cout << std::setw(10) << "pattern" << std::setw(6) << "level"
+	          << std::setw(12) << "cubes" << std::setw(12) << "triangles"
+	          << std::setw(12) << "MB (u32)" << std::setw(12) << "MB (u16)"
+	          << std::setw(12) << "visible" << std::setw(10) << "grid KB"
+	          << std::setw(10) << "area"
+	          << std::setw(10) << "volume" << "\n";
+	for (int p = 0; p < Menger::kNumPatterns; p++) {
+		for (int level = 0; level <= max_level; level++) {
+			Menger::Capacity c = Menger::capacity(Menger::Pattern(p), level,
+					glm::vec3(-0.5f), glm::vec3(0.5f),
+					g_options.cube_soup ? Menger::kCubeSoup : Menger::kCulledFaces);
+			std::cout << std::setw(10) << Menger::pattern_name(Menger::Pattern(p))
+			          << std::setw(6) << level
+			          << std::setw(12) << c.cubes << std::setw(12) << c.triangles
+			          << std::setw(12) << (c.bytes[Menger::kIndex32] >> 20)
+			          << std::setw(12) << (c.bytes[Menger::kIndex16] >> 20)
+			          << std::setw(12) << c.visible_faces
+			          << std::setw(10) << (c.grid_bytes + 1023) / 1024
+			          << std::setw(10) << c.surface_area
+			          << std::setw(10) << c.volume << "\n";
+		}
+	}
+}
+
+// Vertical field of view of the scene camera, in radians.
+const float kFieldOfView = glm::radians(45.0f);
+
+glm::mat4 scene_projection(float aspect)
+{
+	return glm::perspective(kFieldOfView, aspect, 0.0001f, 1000.0f);
+}
+
+void upload_frame_uniforms(const FrameUniforms& uniforms)
+{
+	g_gl.bind_buffer(GL_UNIFORM_BUFFER, g_frame_uniform_buffer);
+	g_gl.buffer_sub_data(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &uniforms);
+}
+
+// Draws `count` faces of the sponge from `first`, with 32-bit indices in
+// generation order.
+void draw_faces(size_t first, size_t count)
+{
+	g_gl.draw_elements(GL_TRIANGLES, count * 3, GL_UNSIGNED_INT,
+	                   (void*)(first * sizeof(glm::uvec3)));
+}
+
+void draw_floor(const Scene& scene)
+{
+	g_gl.bind_vertex_array(g_array_objects[kFloorVao]);
+	g_gl.use_program(scene.floor_program_id);
+	g_gl.draw_elements(GL_TRIANGLES, scene.floor_index_count, GL_UNSIGNED_INT, 0);
+}
+
+// Draws the sponge and the floor into the bound framebuffer and viewport.
+// When `interactive`, chunks may be culled on the GPU or drawn as
+// impostors; offscreen captures always draw everything.
+void draw_scene(const Scene& scene, bool interactive)
+{
+	if (interactive && scene.culler) {
+		// The floor goes first so that it occludes too.
+		draw_floor(scene);
+		scene.culler->draw(g_array_objects[kGeometryVao], scene.program_id);
+		return;
+	}
+
+	g_gl.bind_vertex_array(g_array_objects[kGeometryVao]);
+	g_gl.use_program(scene.program_id);
+	if (interactive && scene.impostors) {
+		// Runs of neighboring chunks still drawn as geometry share a draw.
+		const std::vector<Menger::Chunk>& chunks = scene.impostors->chunks();
+		size_t first = 0, count = 0;
+		for (size_t i = 0; i < chunks.size(); i++) {
+			if (!scene.impostors->draws_geometry(i))
+				continue;
+			if (count > 0 && first + count != chunks[i].first_face) {
+				draw_faces(first, count);
+				count = 0;
+			}
+			if (count == 0)
+				first = chunks[i].first_face;
+			count += chunks[i].face_count;
+		}
+		if (count > 0)
+			draw_faces(first, count);
+	} else {
+		const MeshDraw& menger_draw = scene.menger_draw;
+		size_t index_size = menger_draw.index_type == GL_UNSIGNED_SHORT ?
+			sizeof(uint16_t) : sizeof(uint32_t);
+		for (const IndexRange& range : menger_draw.ranges) {
+			g_gl.draw_elements_base_vertex(GL_TRIANGLES, range.index_count,
+					menger_draw.index_type,
+					(void*)(range.first_index * index_size),
+					range.base_vertex);
+		}
+	}
+
+	draw_floor(scene);
+
+	if (interactive && scene.impostors)
+		scene.impostors->draw();
+}
+
+// Shows the CPU and GPU time per frame since the last update in the window
+// title, about once a second.
+void show_frame_times(GLFWwindow* window, const std::string& title)
+{
+	static double last_update = 0.0;
+	static Profiler::Stats last_cpu, last_draw;
+	static double last_gpu_ms = 0.0;
+	double now = glfwGetTime();
+	if (now - last_update < 1.0)
+		return;
+	Profiler::Stats cpu = g_profiler.stats("frame", false);
+	// The GPU time of a frame is every GPU stage, not just the draw. Each
+	// drawn frame has one draw, so the draws count the frames.
+	Profiler::Stats draw = g_profiler.stats("draw", true);
+	double gpu_ms = g_profiler.total_ms(true);
+	std::ostringstream text;
+	text << title << std::fixed << std::setprecision(2);
+	if (cpu.count > last_cpu.count)
+		text << " - CPU " << (cpu.total_ms - last_cpu.total_ms) / (cpu.count - last_cpu.count)
+		     << " ms";
+	if (draw.count > last_draw.count)
+		text << ", GPU " << (gpu_ms - last_gpu_ms) / (draw.count - last_draw.count)
+		     << " ms";
+	glfwSetWindowTitle(window, text.str().c_str());
+	last_update = now;
+	last_cpu = cpu;
+	last_draw = draw;
+	last_gpu_ms = gpu_ms;
+}
 
 bool g_ctrl_pressed;
 bool g_shift_pressed;
@@ -123,6 +627,8 @@ KeyCallback(GLFWwindow* window,
     // Note:
     // This is only a list of functions to implement.
     // you may want to re-organize this piece of code.
+    if (action != GLFW_RELEASE)
+        g_redraw = true;
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
         glfwSetWindowShouldClose(window, GL_TRUE);
     } else if (key == GLFW_KEY_W && action != GLFW_RELEASE) {
@@ -150,19 +656,25 @@ KeyCallback(GLFWwindow* window,
     } else if (key == GLFW_KEY_C && action != GLFW_RELEASE) {
 		fps  = !fps;
 		std::cout << "FPS: " << fps << std::endl;
+    } else if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+		g_capture_requested = true;
     }
     if (!g_menger)
         return ; // 0-4 only available in Menger mode.
     if (key == GLFW_KEY_0 && action != GLFW_RELEASE) {
-		g_menger->set_nesting_level(0);
+		select_sponge(g_menger->pattern(), 0);
     } else if (key == GLFW_KEY_1 && action != GLFW_RELEASE) {
-		g_menger->set_nesting_level(1);
+		select_sponge(g_menger->pattern(), 1);
     } else if (key == GLFW_KEY_2 && action != GLFW_RELEASE) {
-		g_menger->set_nesting_level(2);
+		select_sponge(g_menger->pattern(), 2);
     } else if (key == GLFW_KEY_3 && action != GLFW_RELEASE) {
-		g_menger->set_nesting_level(3);
+		select_sponge(g_menger->pattern(), 3);
     } else if (key == GLFW_KEY_4 && action != GLFW_RELEASE) {
-		g_menger->set_nesting_level(4);
+		select_sponge(g_menger->pattern(), 4);
+    } else if (key == GLFW_KEY_V && action == GLFW_PRESS) {
+		// Cycle through the sponge variants.
+		int next = (g_menger->pattern() + 1) % Menger::kNumPatterns;
+		select_sponge(Menger::Pattern(next), g_menger->nesting_level());
     }
 
 
@@ -184,6 +696,9 @@ bool g_mouse_pressed;
 glm::vec2 prevMouse(0.0f, 0.0f);
 
 void generate_floor(std::vector<glm::vec4> &vertices, std::vector<glm::vec4> &normals, std::vector<glm::uvec3> &faces);
+MeshDraw upload_menger(const Menger& menger);
+long resident_kb(const char* field);
+void reset_peak_resident();
 
 void
 MousePosCallback(GLFWwindow* window, double mouse_x, double mouse_y)
@@ -192,6 +707,7 @@ MousePosCallback(GLFWwindow* window, double mouse_x, double mouse_y)
     glm::vec2 deltaMouse = mouse - prevMouse;
 
 	if (g_mouse_pressed && g_prev_mouse_pressed) {
+        g_redraw = true;
         if (g_current_button == GLFW_MOUSE_BUTTON_LEFT && !g_alt_pressed && !g_shift_pressed && !g_ctrl_pressed) {
             g_camera.pitch((180.0f / M_PI) * -deltaMouse.y / window_width);
             g_camera.yaw((180.0f /  M_PI) * -deltaMouse.x / window_height);
@@ -213,53 +729,140 @@ MouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 	g_current_button = button;
 }
 
+void
+FramebufferSizeCallback(GLFWwindow* window, int width, int height)
+{
+	g_redraw = true;
+}
+
+void
+WindowRefreshCallback(GLFWwindow* window)
+{
+	g_redraw = true;
+}
+
 int main(int argc, char* argv[])
 {
 	std::string window_title = "Menger";
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--copy-upload") == 0) {
+			g_options.copy_upload = true;
+		} else if (strcmp(argv[i], "--optimize-mesh") == 0) {
+			g_options.optimize_mesh = true;
+		} else if (strcmp(argv[i], "--index16") == 0) {
+			g_options.index16 = true;
+		} else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc &&
+		           parse_megabytes(argv[i + 1]) > 0) {
+			g_options.memory_budget = parse_megabytes(argv[++i]);
+		} else if (strcmp(argv[i], "--continuous") == 0) {
+			g_options.continuous = true;
+		} else if (strcmp(argv[i], "--cube-soup") == 0) {
+			g_options.cube_soup = true;
+		} else if (strcmp(argv[i], "--impostors") == 0) {
+			g_options.impostors = true;
+		} else if (strcmp(argv[i], "--impostor-size") == 0 && i + 1 < argc &&
+		           atoi(argv[i + 1]) > 0 &&
+		           atoi(argv[i + 1]) <= ImpostorCache::kMaxResolution) {
+			g_options.impostor.resolution = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--gpu-culling") == 0) {
+			g_options.gpu_culling = true;
+		} else if (strcmp(argv[i], "--no-normals") == 0) {
+			g_options.no_normals = true;
+		} else if (strcmp(argv[i], "--profile") == 0) {
+			g_options.profile = true;
+		} else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+			g_options.profile = true;
+			g_options.trace_path = argv[++i];
+		} else if (strcmp(argv[i], "--capture-size") == 0 && i + 1 < argc &&
+		           sscanf(argv[i + 1], "%dx%d", &g_options.capture.width,
+		                  &g_options.capture.height) == 2 &&
+		           g_options.capture.width > 0 && g_options.capture.height > 0) {
+			i++;
+		} else if (strcmp(argv[i], "--tile-size") == 0 && i + 1 < argc &&
+		           atoi(argv[i + 1]) > 0) {
+			g_options.capture.tile_size = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--capture-file") == 0 && i + 1 < argc) {
+			g_options.capture.path = argv[++i];
+		} else if (strcmp(argv[i], "--capacity") == 0) {
+			print_capacity_table(6);
+			exit(EXIT_SUCCESS);
+		} else if (strcmp(argv[i], "--validate") == 0) {
+			exit(validate_geometry(argc - i - 1, argv + i + 1));
+		} else {
+			std::cerr << "Usage: " << argv[0]
+			          << " [--copy-upload] [--optimize-mesh] [--index16]"
+			          << " [--memory-budget MB] [--continuous] [--cube-soup]"
+			          << " [--impostors] [--impostor-size N] [--gpu-culling]"
+			          << " [--profile] [--trace PATH] [--no-normals]"
+			          << " [--capture-size WxH] [--tile-size N] [--capture-file PATH]"
+			          << " [--capacity]"
+			          << " [--validate [<mode> <pattern> <level> <min> <max>]]\n";
+			exit(EXIT_FAILURE);
+		}
+	}
+	if ((g_options.impostors || g_options.gpu_culling) &&
+	    (g_options.optimize_mesh || g_options.index16)) {
+		std::cerr << "Chunked drawing needs faces in generation order;"
+		          << " ignoring --impostors and --gpu-culling\n";
+		g_options.impostors = g_options.gpu_culling = false;
+	}
+	if (g_options.impostors && g_options.gpu_culling) {
+		std::cerr << "--impostors and --gpu-culling do not combine; ignoring --impostors\n";
+		g_options.impostors = false;
+	}
 	if (!glfwInit()) exit(EXIT_FAILURE);
 	g_menger = std::make_shared<Menger>(glm::vec3(-0.5, -0.5, -0.5), glm::vec3(0.5, 0.5, 0.5));
+	if (g_options.cube_soup)
+		g_menger->set_mesher(Menger::kCubeSoup);
+	// The sponge is generated by the render loop while it is dirty. It
+	// starts at level 4 as it always has; a budget too small for that is
+	// reported rather than worked around with some other level.
+	if (!select_sponge(g_menger->pattern(), 4)) {
+		std::cerr << "Raise --memory-budget or choose a cheaper upload path\n";
+		glfwTerminate();
+		exit(EXIT_FAILURE);
+	}
 	glfwSetErrorCallback(ErrorCallback);
 
 	// Ask an OpenGL 3.3 core profile context 
 	// It is required on OSX and non-NVIDIA Linux
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	// GPU culling needs 4.3; without it, fall back to 3.3 and plain draws.
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, g_options.gpu_culling ? 4 : 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	GLFWwindow* window = glfwCreateWindow(window_width, window_height,
 			&window_title[0], nullptr, nullptr);
+	if (!window && g_options.gpu_culling) {
+		std::cerr << "No OpenGL 4.3 context; drawing without GPU culling\n";
+		g_options.gpu_culling = false;
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		window = glfwCreateWindow(window_width, window_height,
+				&window_title[0], nullptr, nullptr);
+	}
 	CHECK_SUCCESS(window != nullptr);
 	glfwMakeContextCurrent(window);
 	glewExperimental = GL_TRUE;
 
 	CHECK_SUCCESS(glewInit() == GLEW_OK);
 	glGetError();  // clear GLEW's error for it
+	if (g_options.gpu_culling && !GpuCuller::supported()) {
+		std::cerr << "OpenGL 4.3 is not supported; drawing without GPU culling\n";
+		g_options.gpu_culling = false;
+	}
+	if (g_options.profile)
+		g_profiler.enable(true);
 	glfwSetKeyCallback(window, KeyCallback);
 	glfwSetCursorPosCallback(window, MousePosCallback);
 	glfwSetMouseButtonCallback(window, MouseButtonCallback);
+	glfwSetFramebufferSizeCallback(window, FramebufferSizeCallback);
+	glfwSetWindowRefreshCallback(window, WindowRefreshCallback);
 	glfwSwapInterval(1);
 	const GLubyte* renderer = glGetString(GL_RENDERER);  // get renderer string
 	const GLubyte* version = glGetString(GL_VERSION);    // version as a string
 	std::cout << "Renderer: " << renderer << "\n";
 	std::cout << "OpenGL version supported:" << version << "\n";
 
-	std::vector<glm::vec4> obj_vertices;
-	std::vector<glm::vec4> vtx_normals;
-	std::vector<glm::uvec3> obj_faces;
-
-	g_menger->set_nesting_level(4);
-	g_menger->generate_geometry(obj_vertices, vtx_normals, obj_faces);
-	g_menger->set_clean();
-
-	glm::vec4 min_bounds = glm::vec4(std::numeric_limits<float>::max());
-	glm::vec4 max_bounds = glm::vec4(-std::numeric_limits<float>::max());
-	for (unsigned i = 0; i < obj_vertices.size(); ++i) {
-		min_bounds = glm::min(obj_vertices[i], min_bounds);
-		max_bounds = glm::max(obj_vertices[i], max_bounds);
-	}
-	std::cout << "min_bounds = " << glm::to_string(min_bounds) << "\n";
-	std::cout << "max_bounds = " << glm::to_string(max_bounds) << "\n";
-
     /*===================================================================================
  	 *======================= GLM LOADING VBO AND VAO FOR MENGER ========================
 	 *===================================================================================*/
@@ -268,33 +871,26 @@ int main(int argc, char* argv[])
 	CHECK_GL_ERROR(glGenVertexArrays(kNumVaos, &g_array_objects[0]));
 
 	// Switch to the VAO for Geometry.
-	CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kGeometryVao]));
+	g_gl.bind_vertex_array(g_array_objects[kGeometryVao]);
 
 	// Generate buffer objects
 	CHECK_GL_ERROR(glGenBuffers(kNumVbos, &g_buffer_objects[kGeometryVao][0]));
 
 	// Setup vertex data in a VBO.
-	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kGeometryVao][kVertexBuffer]));
-	// NOTE: We do not send anything right now, we just describe it to OpenGL.
-	CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-				sizeof(float) * obj_vertices.size() * 4, nullptr,
-				GL_STATIC_DRAW));
+	// NOTE: Storage is allocated by upload_menger once the size is known.
+	g_gl.bind_buffer(GL_ARRAY_BUFFER, g_buffer_objects[kGeometryVao][kVertexBuffer]);
 	CHECK_GL_ERROR(glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0));
 	CHECK_GL_ERROR(glEnableVertexAttribArray(0));
 
-	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kGeometryVao][kNormalBuffer]));
-	// NOTE: We do not send anything right now, we just describe it to OpenGL.
-	CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-				sizeof(float) * vtx_normals.size() * 4, nullptr,
-				GL_STATIC_DRAW));
-	CHECK_GL_ERROR(glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, 0));
-	CHECK_GL_ERROR(glEnableVertexAttribArray(1));
+	// Without normals the attribute stays disabled and its buffer empty.
+	if (!g_options.no_normals) {
+		g_gl.bind_buffer(GL_ARRAY_BUFFER, g_buffer_objects[kGeometryVao][kNormalBuffer]);
+		CHECK_GL_ERROR(glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, 0));
+		CHECK_GL_ERROR(glEnableVertexAttribArray(1));
+	}
 
 	// Setup element array buffer.
-	CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_buffer_objects[kGeometryVao][kIndexBuffer]));
-	CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-				sizeof(uint32_t) * obj_faces.size() * 3,
-				&obj_faces[0], GL_STATIC_DRAW));
+	g_gl.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, g_buffer_objects[kGeometryVao][kIndexBuffer]);
 
 
 
@@ -319,223 +915,240 @@ int main(int argc, char* argv[])
         std::cout << "\t(" << vtx.x << ", " << vtx.y << ", " << vtx.z << ")" << std::endl;
 
     // Setup our VAO array.
-	CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kFloorVao]));
+	g_gl.bind_vertex_array(g_array_objects[kFloorVao]);
 
     // Generate buffer objects
 	CHECK_GL_ERROR(glGenBuffers(kNumVbos, &g_buffer_objects[kFloorVao][0]));
 
-    // Setup vertex data in a VBO.
-    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kFloorVao][kVertexBuffer]));
-    // NOTE: We do not send anything right now, we just describe it to OpenGL.
-    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-                                sizeof(float) * floor_vertices.size() * 4, nullptr,
-                                GL_STATIC_DRAW));
+    // Setup vertex data in a VBO. The floor never changes, so upload it once.
+    g_gl.bind_buffer(GL_ARRAY_BUFFER, g_buffer_objects[kFloorVao][kVertexBuffer]);
+    g_gl.buffer_data(GL_ARRAY_BUFFER, sizeof(float) * floor_vertices.size() * 4,
+                     &floor_vertices[0], GL_STATIC_DRAW);
     CHECK_GL_ERROR(glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0));
     CHECK_GL_ERROR(glEnableVertexAttribArray(0));
 
-    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kFloorVao][kNormalBuffer]));
-    // NOTE: We do not send anything right now, we just describe it to OpenGL.
-    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-                                sizeof(float) * floor_normals.size() * 4, nullptr,
-                                GL_STATIC_DRAW));
-    CHECK_GL_ERROR(glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, 0));
-    CHECK_GL_ERROR(glEnableVertexAttribArray(1));
+    if (!g_options.no_normals) {
+        g_gl.bind_buffer(GL_ARRAY_BUFFER, g_buffer_objects[kFloorVao][kNormalBuffer]);
+        g_gl.buffer_data(GL_ARRAY_BUFFER, sizeof(float) * floor_normals.size() * 4,
+                         &floor_normals[0], GL_STATIC_DRAW);
+        CHECK_GL_ERROR(glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, 0));
+        CHECK_GL_ERROR(glEnableVertexAttribArray(1));
+    }
 
     // Setup element array buffer.
-    CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_buffer_objects[kFloorVao][kIndexBuffer]));
-    CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                                sizeof(uint32_t) * floor_faces.size() * 3,
-                                &floor_faces[0], GL_STATIC_DRAW));
-
-
-
-
-	// Setup vertex shader.
-	GLuint vertex_shader_id = 0;
-	const char* vertex_source_pointer = vertex_shader;
-	CHECK_GL_ERROR(vertex_shader_id = glCreateShader(GL_VERTEX_SHADER));
-	CHECK_GL_ERROR(glShaderSource(vertex_shader_id, 1, &vertex_source_pointer, nullptr));
-	glCompileShader(vertex_shader_id);
-	CHECK_GL_SHADER_ERROR(vertex_shader_id);
-
-	// Setup fragment shader.
-	GLuint fragment_shader_id = 0;
-	const char* fragment_source_pointer = fragment_shader;
-	CHECK_GL_ERROR(fragment_shader_id = glCreateShader(GL_FRAGMENT_SHADER));
-	CHECK_GL_ERROR(glShaderSource(fragment_shader_id, 1, &fragment_source_pointer, nullptr));
-	glCompileShader(fragment_shader_id);
-	CHECK_GL_SHADER_ERROR(fragment_shader_id);
-
-	// Let's create our program.
-	GLuint program_id = 0;
-	CHECK_GL_ERROR(program_id = glCreateProgram());
-	CHECK_GL_ERROR(glAttachShader(program_id, vertex_shader_id));
-	CHECK_GL_ERROR(glAttachShader(program_id, fragment_shader_id));
-//	CHECK_GL_ERROR(glAttachShader(program_id, geometry_shader_id));
-
-	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kGeometryVao][kVertexBuffer]));
-	// NOTE: We do not send anything right now, we just describe it to OpenGL.
-	CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-				sizeof(float) * obj_vertices.size() * 4, nullptr,
-				GL_STATIC_DRAW));
-	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kGeometryVao][kNormalBuffer]));
-	// NOTE: We do not send anything right now, we just describe it to OpenGL.
-	CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-				sizeof(float) * vtx_normals.size() * 4, nullptr,
-				GL_STATIC_DRAW));
-	// Bind attributes.
-	CHECK_GL_ERROR(glBindAttribLocation(program_id, 0, "vertex_position"));
-
-	CHECK_GL_ERROR(glBindAttribLocation(program_id, 1, "vertex_normal"));
-	CHECK_GL_ERROR(glBindFragDataLocation(program_id, 0, "fragment_color"));
-	glLinkProgram(program_id);
-	CHECK_GL_PROGRAM_ERROR(program_id);
-
-
-
-	// Get the uniform locations.
-	GLint projection_matrix_location = 0;
-	CHECK_GL_ERROR(projection_matrix_location =
-			glGetUniformLocation(program_id, "projection"));
-	GLint view_matrix_location = 0;
-	CHECK_GL_ERROR(view_matrix_location =
-			glGetUniformLocation(program_id, "view"));
-	GLint light_position_location = 0;
-	CHECK_GL_ERROR(light_position_location =
-			glGetUniformLocation(program_id, "light_position"));
-
-	// Setup fragment shader for the floor
-	GLuint floor_fragment_shader_id = 0;
-	const char* floor_fragment_source_pointer = floor_fragment_shader;
-	CHECK_GL_ERROR(floor_fragment_shader_id = glCreateShader(GL_FRAGMENT_SHADER));
-	CHECK_GL_ERROR(glShaderSource(floor_fragment_shader_id, 1,
-				&floor_fragment_source_pointer, nullptr));
-	glCompileShader(floor_fragment_shader_id);
-	CHECK_GL_SHADER_ERROR(floor_fragment_shader_id);
-
-
-
-
-	// Code for initializing the floor GLSL program
-	GLuint floor_program_id = 0;
-	GLint floor_projection_matrix_location = 0;
-	GLint floor_view_matrix_location = 0;
-	GLint floor_light_position_location = 0;
-
-    CHECK_GL_ERROR(floor_program_id = glCreateProgram());
-    CHECK_GL_ERROR(glAttachShader(floor_program_id, vertex_shader_id));
-    CHECK_GL_ERROR(glAttachShader(floor_program_id, floor_fragment_shader_id));
-    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kFloorVao][kVertexBuffer]));
-    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-                                sizeof(float) * floor_vertices.size() * 4, nullptr,
-                                GL_STATIC_DRAW));
-    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kFloorVao][kNormalBuffer]));
-    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-                                sizeof(float) * floor_normals.size() * 4, nullptr,
-                                GL_STATIC_DRAW));
-    CHECK_GL_ERROR(glBindAttribLocation(floor_program_id, 0, "vertex_position"));
-
-    CHECK_GL_ERROR(glBindAttribLocation(floor_program_id, 1, "vertex_normal"));
-    CHECK_GL_ERROR(glBindFragDataLocation(floor_program_id, 0, "fragment_color"));
-    glLinkProgram(floor_program_id);
-    CHECK_GL_PROGRAM_ERROR(floor_program_id);
-    CHECK_GL_ERROR(floor_projection_matrix_location =
-                           glGetUniformLocation(floor_program_id, "projection"));
-    CHECK_GL_ERROR(floor_view_matrix_location =
-                           glGetUniformLocation(floor_program_id, "view"));
-    CHECK_GL_ERROR(floor_light_position_location =
-                           glGetUniformLocation(floor_program_id, "light_position"));
+    g_gl.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, g_buffer_objects[kFloorVao][kIndexBuffer]);
+    g_gl.buffer_data(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * floor_faces.size() * 3,
+                     &floor_faces[0], GL_STATIC_DRAW);
+
+
+
+
+	// Link both programs, from the on-disk binary cache when possible.
+	auto programs_start = std::chrono::steady_clock::now();
+	const char* cache_dir = getenv("MENGER_SHADER_CACHE");
+	ProgramCache program_cache(cache_dir ? cache_dir : ".menger-shader-cache");
+	std::vector<std::string> attributes = { "vertex_position", "vertex_normal" };
+
+	// --no-normals defines DERIVED_NORMALS in every stage and gives the
+	// fragment stages derived_normal().
+	std::string vertex_source = vertex_shader;
+	std::string fragment_source = fragment_shader;
+	std::string floor_fragment_source = floor_fragment_shader;
+	if (g_options.no_normals) {
+		std::string fragment_header = std::string(derived_normals_header) +
+		                              derived_normal_function;
+		vertex_source = shader_variant(vertex_shader, derived_normals_header);
+		fragment_source = shader_variant(fragment_shader, fragment_header);
+		floor_fragment_source = shader_variant(floor_fragment_shader, fragment_header);
+	}
 
+	GLuint program_id = program_cache.link({ { GL_VERTEX_SHADER, vertex_source.c_str() },
+	                                  { GL_FRAGMENT_SHADER, fragment_source.c_str() } },
+	                                attributes);
+	GLuint floor_program_id = program_cache.link(
+			{ { GL_VERTEX_SHADER, vertex_source.c_str() },
+			  { GL_FRAGMENT_SHADER, floor_fragment_source.c_str() } },
+			attributes);
+
+	GLuint impostor_program_id = program_cache.link(
+			{ { GL_VERTEX_SHADER, impostor_vertex_shader },
+			  { GL_FRAGMENT_SHADER, impostor_fragment_shader } },
+			{});
+
+	GLuint cull_program_id = 0, reduce_program_id = 0;
+	std::vector<GLuint> frame_programs = { program_id, floor_program_id,
+	                                       impostor_program_id };
+	if (g_options.gpu_culling) {
+		cull_program_id = program_cache.link({ { GL_COMPUTE_SHADER, cull_compute_shader } },
+		                                     {});
+		reduce_program_id = program_cache.link(
+				{ { GL_COMPUTE_SHADER, reduce_compute_shader } }, {});
+		frame_programs.push_back(cull_program_id);
+	}
 
+	// Block bindings are not part of the program binary, so always set them.
+	for (GLuint id : frame_programs) {
+		GLuint block_index = 0;
+		CHECK_GL_ERROR(block_index = glGetUniformBlockIndex(id, "FrameUniforms"));
+		CHECK_GL_ERROR(glUniformBlockBinding(id, block_index, kFrameUniformBinding));
+	}
+	std::chrono::duration<double, std::milli> programs_time =
+		std::chrono::steady_clock::now() - programs_start;
+	std::cout << "Programs ready in " << programs_time.count() << " ms ("
+	          << program_cache.hits() << " cached, "
+	          << program_cache.misses() << " compiled)\n";
+
+	// Setup the shared per-frame uniform buffer.
+	CHECK_GL_ERROR(glGenBuffers(1, &g_frame_uniform_buffer));
+	g_gl.bind_buffer(GL_UNIFORM_BUFFER, g_frame_uniform_buffer);
+	g_gl.buffer_data(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+	g_gl.bind_buffer_base(GL_UNIFORM_BUFFER, kFrameUniformBinding, g_frame_uniform_buffer);
 
 	glm::vec4 light_position = glm::vec4(2.0f, 2.0f, 2.0f, 1.0f);
 	float aspect = 0.0f;
 	float theta = 0.0f;
+	Scene scene;
+	scene.program_id = program_id;
+	scene.floor_program_id = floor_program_id;
+	scene.floor_index_count = floor_faces.size() * 3;
+	std::unique_ptr<ImpostorCache> impostors;
+	if (g_options.impostors)
+		impostors.reset(new ImpostorCache(g_gl, impostor_program_id, g_options.impostor));
+	scene.impostors = impostors.get();
+	std::unique_ptr<GpuCuller> culler;
+	if (g_options.gpu_culling)
+		culler.reset(new GpuCuller(g_gl, cull_program_id, reduce_program_id));
+	scene.culler = culler.get();
+	FrameUniforms frame_uniforms;
+	std::chrono::duration<double, std::micro> uniform_time(0);
+	unsigned long frames = 0;
 	while (!glfwWindowShouldClose(window)) {
-		// Setup some basic window stuff.
+		// Unless running continuously, sleep until an event changes what is
+		// on screen.
+		if (!g_options.continuous && !g_redraw && !(g_menger && g_menger->is_dirty())) {
+			glfwWaitEvents();
+			continue;
+		}
+		g_redraw = false;
+		ProfileScope frame_scope("frame");
 		glfwGetFramebufferSize(window, &window_width, &window_height);
-		glViewport(0, 0, window_width, window_height);
-		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-		glEnable(GL_DEPTH_TEST);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glDepthFunc(GL_LESS);
-
-		// Switch to the Geometry VAO.
-		CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kGeometryVao]));
 
 		if (g_menger && g_menger->is_dirty()) {
-            obj_vertices.clear();
-            vtx_normals.clear();
-            obj_faces.clear();
-		    g_menger->generate_geometry(obj_vertices, vtx_normals, obj_faces);
-            std::cout << "Number of vertices: " << obj_vertices.size() << std::endl;
+			PROFILE_SCOPE("upload");
+			PROFILE_GPU_SCOPE("upload");
+			reset_peak_resident();
+			long rss_before = resident_kb("VmRSS");
+			scene.menger_draw = upload_menger(*g_menger);
+			std::cout << "Number of vertices: " << g_menger->vertex_count() << std::endl;
+			std::cout << "Level switch (" << (g_options.copy_upload ? "copy" : "mapped")
+			          << " upload): RSS " << rss_before / 1024 << " -> "
+			          << resident_kb("VmRSS") / 1024 << " MB, peak "
+			          << resident_kb("VmHWM") / 1024 << " MB\n";
+			if (scene.impostors)
+				scene.impostors->set_chunks(scene.menger_draw.chunks);
+			if (scene.culler)
+				scene.culler->set_chunks(scene.menger_draw.chunks);
 			g_menger->set_clean();
 		}
 
 		// Compute the projection matrix.
 		aspect = static_cast<float>(window_width) / window_height;
-		glm::mat4 projection_matrix =
-			glm::perspective(glm::radians(45.0f), aspect, 0.0001f, 1000.0f);
+		glm::mat4 projection_matrix = scene_projection(aspect);
 
 		// Compute the view matrix
 		// FIXME: change eye and center through mouse/keyboard events.
 		glm::mat4 view_matrix = g_camera.get_view_matrix();
 
-		// Send vertices to the GPU.
-		CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER,
-		                            g_buffer_objects[kGeometryVao][kVertexBuffer]));
-		CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-		                            sizeof(float) * obj_vertices.size() * 4,
-		                            &obj_vertices[0], GL_STATIC_DRAW));
-		CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER,
-		                            g_buffer_objects[kGeometryVao][kNormalBuffer]));
-		CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-		                            sizeof(float) * vtx_normals.size() * 4,
-		                            &vtx_normals[0], GL_STATIC_DRAW));
-		// Use our program.
-		CHECK_GL_ERROR(glUseProgram(program_id));
-
-		// Pass uniforms in.
-		CHECK_GL_ERROR(glUniformMatrix4fv(projection_matrix_location, 1, GL_FALSE,
-					&projection_matrix[0][0]));
-		CHECK_GL_ERROR(glUniformMatrix4fv(view_matrix_location, 1, GL_FALSE,
-					&view_matrix[0][0]));
-		CHECK_GL_ERROR(glUniform4fv(light_position_location, 1, &light_position[0]));
-
-		// Draw our triangles.
-		CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, obj_faces.size() * 3, GL_UNSIGNED_INT, 0));
-
-
-        CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kFloorVao]));
-
-        // Send vertices to the GPU.
-        CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER,
-                                    g_buffer_objects[kFloorVao][kVertexBuffer]));
-        CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-                                    sizeof(float) * floor_vertices.size() * 4,
-                                    &floor_vertices[0], GL_STATIC_DRAW));
-        CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER,
-                                    g_buffer_objects[kFloorVao][kNormalBuffer]));
-        CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-                                    sizeof(float) * floor_normals.size() * 4,
-                                    &floor_normals[0], GL_STATIC_DRAW));
-        // Use our program.
-        CHECK_GL_ERROR(glUseProgram(floor_program_id));
-
-        // Pass uniforms in.
-        CHECK_GL_ERROR(glUniformMatrix4fv(floor_projection_matrix_location, 1, GL_FALSE,
-                                          &projection_matrix[0][0]));
-        CHECK_GL_ERROR(glUniformMatrix4fv(floor_view_matrix_location, 1, GL_FALSE,
-                                          &view_matrix[0][0]));
-        CHECK_GL_ERROR(glUniform4fv(floor_light_position_location, 1, &light_position[0]));
-
-        // Draw our triangles.
-        CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, floor_faces.size() * 3, GL_UNSIGNED_INT, 0));
+		// Capture impostors first; they render into their own framebuffer.
+		if (scene.impostors) {
+			PROFILE_SCOPE("impostors");
+			PROFILE_GPU_SCOPE("impostors");
+			scene.impostors->update(g_camera.get_eye_position(), kFieldOfView,
+			                        window_height,
+			                        [&](const Menger::Chunk& chunk,
+			                            const glm::mat4& projection,
+			                            const glm::mat4& view) {
+				FrameUniforms capture_uniforms = { projection, view, light_position };
+				upload_frame_uniforms(capture_uniforms);
+				g_gl.bind_vertex_array(g_array_objects[kGeometryVao]);
+				g_gl.use_program(program_id);
+				draw_faces(chunk.first_face, chunk.face_count);
+			});
+		}
+
+		// Setup some basic window stuff.
+		if (scene.culler)
+			scene.culler->bind_framebuffer(window_width, window_height);
+		g_gl.viewport(0, 0, window_width, window_height);
+		g_gl.clear_color(0.0f, 0.0f, 0.0f, 0.0f);
+		g_gl.set_capability(GL_DEPTH_TEST, true);
+		g_gl.clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		g_gl.depth_func(GL_LESS);
+
+		// Upload the per-frame uniforms once for every program.
+		auto uniform_start = std::chrono::steady_clock::now();
+		frame_uniforms.projection = projection_matrix;
+		frame_uniforms.view = view_matrix;
+		frame_uniforms.light_position = light_position;
+		upload_frame_uniforms(frame_uniforms);
+		uniform_time += std::chrono::steady_clock::now() - uniform_start;
+		frames++;
+
+		{
+			PROFILE_SCOPE("draw");
+			PROFILE_GPU_SCOPE("draw");
+			draw_scene(scene, true);
+			if (scene.culler)
+				scene.culler->present();
+		}
+		g_gl.end_frame();
+
+		if (g_capture_requested) {
+			// Same camera and field of view, at the capture's aspect ratio.
+			PROFILE_SCOPE("capture");
+			g_capture_requested = false;
+			const CaptureSettings& capture = g_options.capture;
+			capture_tiled(g_gl, capture,
+			              scene_projection(float(capture.width) / capture.height),
+			              [&](const glm::mat4& tile_projection) {
+				frame_uniforms.projection = tile_projection;
+				upload_frame_uniforms(frame_uniforms);
+				draw_scene(scene, false);
+			});
+			g_redraw = true;
+		}
 
 		// Poll and swap.
-		glfwPollEvents();
-		glfwSwapBuffers(window);
+		{
+			PROFILE_SCOPE("swap");
+			glfwPollEvents();
+			glfwSwapBuffers(window);
+		}
+		g_profiler.end_frame();
+		if (g_profiler.enabled())
+			show_frame_times(window, window_title);
+	}
+	std::cout << "Frames drawn: " << frames << " in " << glfwGetTime() << " s\n";
+	if (frames > 0)
+		std::cout << "Frame uniform upload: " << uniform_time.count() / frames
+		          << " us/frame over " << frames << " frames\n";
+	if (g_gl.frames() > 0) {
+		const GLState::Counters& total = g_gl.total();
+		std::cout << "GL calls per frame: " << double(total.issued) / g_gl.frames()
+		          << " issued, " << double(total.skipped) / g_gl.frames()
+		          << " skipped (last frame " << g_gl.last_frame().issued << " issued, "
+		          << g_gl.last_frame().skipped << " skipped)\n";
 	}
+	if (g_profiler.enabled()) {
+		g_profiler.finish();
+		g_profiler.print_summary(std::cout);
+		if (!g_options.trace_path.empty())
+			g_profiler.write_trace(g_options.trace_path);
+	}
+	if (impostors)
+		std::cout << "Impostor captures: " << impostors->captures() << "\n";
+	impostors.reset();
+	culler.reset();
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	exit(EXIT_SUCCESS);
@@ -558,3 +1171,130 @@ void generate_floor(std::vector<glm::vec4> &vertices, std::vector<glm::vec4> &no
     faces.push_back(glm::uvec3(idx, idx + 1, idx + 2));
     faces.push_back(glm::uvec3(idx, idx + 2, idx + 3));
 }
+
+namespace {
+	const GLbitfield kMapFlags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+
+	// (Re)allocates `bytes` of storage for buffer `id` and maps all of it
+	// for writing through `target`.
+	void* map_buffer(GLenum target, GLuint id, size_t bytes)
+	{
+		void* ptr = nullptr;
+		g_gl.bind_buffer(target, id);
+		g_gl.buffer_data(target, bytes, nullptr, GL_STATIC_DRAW);
+		CHECK_GL_ERROR(ptr = glMapBufferRange(target, 0, bytes, kMapFlags));
+		CHECK_SUCCESS(ptr != nullptr);
+		return ptr;
+	}
+};
+
+// Regenerates the sponge into the geometry VAO buffers and returns how to
+// draw it. By default the geometry is written straight into mapped buffers
+// sized from the known counts, so no CPU-side copy ever exists.
+MeshDraw upload_menger(const Menger& menger)
+{
+	size_t vertices = menger.vertex_count();
+	size_t faces = menger.face_count();
+	GLuint* vbos = g_buffer_objects[kGeometryVao];
+	g_gl.bind_vertex_array(g_array_objects[kGeometryVao]);
+
+	MeshDraw draw;
+	draw.index_type = GL_UNSIGNED_INT;
+	IndexRange everything = { 0, faces * 3, 0 };
+	draw.ranges.push_back(everything);
+
+	if (g_options.copy_upload || g_options.optimize_mesh || g_options.index16) {
+		std::vector<glm::vec4> obj_vertices;
+		std::vector<glm::vec4> vtx_normals;
+		std::vector<glm::uvec3> obj_faces;
+		menger.generate_geometry(obj_vertices, vtx_normals, obj_faces, &draw.chunks);
+
+		if (g_options.optimize_mesh) {
+			PROFILE_SCOPE("optimize");
+			CacheStats before = analyze_vertex_cache(obj_faces, obj_vertices.size());
+			optimize_vertex_cache(obj_faces, obj_vertices.size());
+			optimize_vertex_fetch(obj_vertices, vtx_normals, obj_faces);
+			CacheStats after = analyze_vertex_cache(obj_faces, obj_vertices.size());
+			std::cout << "Vertex cache: ACMR " << before.acmr << " -> " << after.acmr
+			          << ", ATVR " << before.atvr << " -> " << after.atvr << "\n";
+		}
+
+		g_gl.bind_buffer(GL_ARRAY_BUFFER, vbos[kVertexBuffer]);
+		g_gl.buffer_data(GL_ARRAY_BUFFER, sizeof(glm::vec4) * obj_vertices.size(),
+		                 &obj_vertices[0], GL_STATIC_DRAW);
+		if (!g_options.no_normals) {
+			g_gl.bind_buffer(GL_ARRAY_BUFFER, vbos[kNormalBuffer]);
+			g_gl.buffer_data(GL_ARRAY_BUFFER, sizeof(glm::vec4) * vtx_normals.size(),
+			                 &vtx_normals[0], GL_STATIC_DRAW);
+		}
+		g_gl.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, vbos[kIndexBuffer]);
+		if (g_options.index16) {
+			std::vector<uint16_t> short_indices;
+			draw.index_type = GL_UNSIGNED_SHORT;
+			draw.ranges = build_short_ranges(obj_faces, short_indices);
+			g_gl.buffer_data(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * short_indices.size(),
+			                 &short_indices[0], GL_STATIC_DRAW);
+			std::cout << "16-bit indices: " << draw.ranges.size() << " ranges, "
+			          << sizeof(uint16_t) * short_indices.size() / 1024 << " kB\n";
+		} else {
+			g_gl.buffer_data(GL_ELEMENT_ARRAY_BUFFER, sizeof(glm::uvec3) * faces,
+			                 &obj_faces[0], GL_STATIC_DRAW);
+		}
+		return draw;
+	}
+
+	// The normals go through GL_COPY_WRITE_BUFFER so all three buffers can
+	// be mapped at once. Unmapping fails if the driver lost the contents
+	// (e.g. a mode switch), in which case the level is generated again.
+	std::vector<GLenum> mapped = { GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER };
+	if (!g_options.no_normals)
+		mapped.push_back(GL_COPY_WRITE_BUFFER);
+	GLboolean intact = GL_FALSE;
+	while (!intact) {
+		Span<glm::vec4> vertex_span = {
+			static_cast<glm::vec4*>(map_buffer(GL_ARRAY_BUFFER, vbos[kVertexBuffer],
+			                                   sizeof(glm::vec4) * vertices)),
+			vertices };
+		Span<glm::vec4> normal_span = { nullptr, 0 };
+		if (!g_options.no_normals)
+			normal_span = {
+				static_cast<glm::vec4*>(map_buffer(GL_COPY_WRITE_BUFFER, vbos[kNormalBuffer],
+				                                   sizeof(glm::vec4) * vertices)),
+				vertices };
+		Span<glm::uvec3> face_span = {
+			static_cast<glm::uvec3*>(map_buffer(GL_ELEMENT_ARRAY_BUFFER, vbos[kIndexBuffer],
+			                                    sizeof(glm::uvec3) * faces)),
+			faces };
+		menger.generate_geometry(vertex_span, normal_span, face_span, 0, &draw.chunks);
+
+		intact = GL_TRUE;
+		for (GLenum target : mapped) {
+			GLboolean unmapped = GL_FALSE;
+			CHECK_GL_ERROR(unmapped = glUnmapBuffer(target));
+			intact = intact && unmapped;
+		}
+	}
+	return draw;
+}
+
+// Reads a memory field such as VmRSS or VmHWM from /proc/self/status, in
+// kB. Returns 0 where the file does not exist.
+long resident_kb(const char* field)
+{
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	size_t length = strlen(field);
+	while (std::getline(status, line)) {
+		if (line.compare(0, length, field) == 0 && line[length] == ':')
+			return atol(line.c_str() + length + 1);
+	}
+	return 0;
+}
+
+// Restarts VmHWM from the current RSS so it reports the peak of what
+// follows (Linux 4.0+).
+void reset_peak_resident()
+{
+	std::ofstream clear_refs("/proc/self/clear_refs");
+	clear_refs << "5";
+}
@@ -1,9 +1,120 @@
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include "menger.h"
+#include "profiler.h"
+#include "subdivision.h"
 
 namespace {
 	const int kMinLevel = 0;
 	const int kMaxLevel = 4;
+
+	const int kCubeVertices = 24;
+
+	// Corner of each cube vertex as bits (x, y, z) selecting max over min,
+	// four per face in front, back, right, left, top, bottom order.
+	const int kCubeCorners[kCubeVertices] = {
+		1, 3, 2, 0,
+		5, 7, 6, 4,
+		5, 7, 3, 1,
+		4, 6, 2, 0,
+		6, 2, 3, 7,
+		4, 0, 1, 5,
+	};
+	const glm::vec4 kFaceNormals[6] = {
+		glm::vec4(0.0f, 0.0f, 1.0f, 0.0f), glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
+		glm::vec4(1.0f, 0.0f, 0.0f, 0.0f), glm::vec4(1.0f, 0.0f, 0.0f, 0.0f),
+		glm::vec4(0.0f, 1.0f, 0.0f, 0.0f), glm::vec4(0.0f, 1.0f, 0.0f, 0.0f),
+	};
+
+	// Which side of a cell each cube face lies on, as (axis, positive).
+	const int kFaceAxis[6] = { 2, 2, 0, 0, 1, 1 };
+	const bool kFacePositive[6] = { false, true, true, false, true, false };
+
+	// Writes cube faces at the next free slots, and their normals unless
+	// `normals` is null. Doubles as the engine callback, which writes all
+	// six.
+	struct FaceWriter {
+		glm::vec4* vertices;
+		glm::vec4* normals;
+		glm::uvec3* faces;
+		uint32_t idx;
+
+		void face(const glm::vec3& min, const glm::vec3& max, int f)
+		{
+			for (int i = 0; i < 4; i++) {
+				int corner = kCubeCorners[4 * f + i];
+				vertices[i] = glm::vec4(corner & 1 ? max.x : min.x,
+				                        corner & 2 ? max.y : min.y,
+				                        corner & 4 ? max.z : min.z, 1.0f);
+				if (normals)
+					normals[i] = kFaceNormals[f];
+			}
+			faces[0] = glm::uvec3(idx, idx + 1, idx + 2);
+			faces[1] = glm::uvec3(idx, idx + 2, idx + 3);
+			vertices += 4;
+			if (normals)
+				normals += 4;
+			faces += 2;
+			idx += 4;
+		}
+
+		void operator()(const glm::vec3& min, const glm::vec3& max)
+		{
+			for (int f = 0; f < 6; f++)
+				face(min, max, f);
+		}
+	};
+
+	void rule_masks(Menger::Pattern pattern, uint32_t* keep, uint32_t* recurse)
+	{
+		switch (pattern) {
+		case Menger::kJerusalemCube:
+			*keep = subdivision::JerusalemRule::keep;
+			*recurse = subdivision::JerusalemRule::recurse;
+			break;
+		case Menger::kMoselySnowflake:
+			*keep = subdivision::MoselyRule::keep;
+			*recurse = subdivision::MoselyRule::recurse;
+			break;
+		default:
+			*keep = subdivision::MengerRule::keep;
+			*recurse = subdivision::MengerRule::recurse;
+			break;
+		}
+	}
+
+	subdivision::Measure measure(Menger::Pattern pattern, int level)
+	{
+		uint32_t keep, recurse;
+		rule_masks(pattern, &keep, &recurse);
+		return subdivision::measure(keep, recurse, level);
+	}
+
+	// Meshes are ordered by top-level cell: the 27 cells of the first
+	// step, or the whole box at level 0. Sets the side of one such cell in
+	// lattice cells.
+	int top_cells(int lattice, int* extent)
+	{
+		*extent = lattice >= 3 ? lattice / 3 : lattice;
+		return lattice >= 3 ? 27 : 1;
+	}
+
+	// The culled mesher emits one quad per lattice face on the surface, so
+	// it falls back to the soup wherever that is more.
+	Menger::Mesher meshed_as(const subdivision::Measure& m, Menger::Mesher mesher)
+	{
+		if (mesher == Menger::kCulledFaces && m.surface_faces > m.cubes * 6)
+			return Menger::kCubeSoup;
+		return mesher;
+	}
+
+	// Cube faces the mesher emits: six per leaf cube, or one per lattice
+	// face on the surface.
+	uint64_t quads(const subdivision::Measure& m, Menger::Mesher mesher)
+	{
+		return meshed_as(m, mesher) == Menger::kCubeSoup ? m.cubes * 6 : m.surface_faces;
+	}
 };
 
 Menger::Menger(glm::vec3 min, glm::vec3 max)
@@ -23,6 +134,12 @@ Menger::set_nesting_level(int level)
 	dirty_ = true;
 }
 
+int
+Menger::nesting_level() const
+{
+	return nesting_level_;
+}
+
 bool
 Menger::is_dirty() const
 {
@@ -35,151 +152,304 @@ Menger::set_clean()
 	dirty_ = false;
 }
 
-// FIXME generate Menger sponge geometry
 void
-Menger::generate_geometry(std::vector<glm::vec4>& obj_vertices,
-			  std::vector<glm::vec4>& vtx_normals,
-                          std::vector<glm::uvec3>& obj_faces) const
+Menger::set_pattern(Pattern pattern)
 {
-    if(this->nesting_level_ == 0) {
-        generate_cube(obj_vertices, vtx_normals, obj_faces, min, max);
-        return;
-    }
+	pattern_ = pattern;
+	dirty_ = true;
+}
 
-    //std::cout << "Third: (" << third.x << ", " << third.y << ", " << third.z << ")" << std::endl;
-    //std::cout << "ThirdX: (" << thirdx.x << ", " << thirdx.y << ", " << thirdx.z << ")" << std::endl;
-    //std::cout << "ThirdY: (" << thirdy.x << ", " << thirdy.y << ", " << thirdy.z << ")" << std::endl;
-    //std::cout << "ThirdZ: (" << thirdz.x << ", " << thirdz.y << ", " << thirdz.z << ")" << std::endl;
-
-    std::vector<glm::vec3> mins;
-    mins.push_back(this->min);
-
-    for(int l = 1; l <= nesting_level_; l++) {
-        glm::vec3 third = (max - min) * float(1.0f / pow(3.0f, l));
-        glm::vec3 thirdx = glm::vec3(third.x, 0, 0);
-        glm::vec3 thirdy = glm::vec3(0, third.y, 0);
-        glm::vec3 thirdz = glm::vec3(0, 0, third.z);
-
-        std::vector<glm::vec3> subcubeMins;
-        subcubeMins = mins;
-        mins.clear();
-
-        for(glm::vec3 minvec : subcubeMins) {
-            mins.push_back(minvec);                                                 // Bottom left front
-            mins.push_back(minvec + thirdx);                                        // Bottom center front
-            mins.push_back(minvec + 2.0f * thirdx);                                 // Bottom right front
-            mins.push_back(minvec + thirdz);                                        // Bottom left middle
-            mins.push_back(minvec + thirdz + 2.0f * thirdx);                        // Bottom right middle
-            mins.push_back(minvec + 2.0f * thirdz);                                 // Bottom left back
-            mins.push_back(minvec + 2.0f * thirdz + thirdx);                        // Bottom center back
-            mins.push_back(minvec + 2.0f * thirdz + 2.0f * thirdx);                 // Bottom right back
-
-            mins.push_back(minvec + thirdy);                                        // Center left front
-            mins.push_back(minvec + thirdy + 2.0f * thirdz);                        // Center left back
-            mins.push_back(minvec + thirdy + 2.0f * thirdz + 2.0f * thirdx);        // Center right back
-            mins.push_back(minvec + thirdy + 2.0f * thirdx);                        // Center right front
-
-            mins.push_back(minvec + 2.0f * thirdy);                                 // Top left front
-            mins.push_back(minvec + 2.0f * thirdy + thirdx);                        // Top center front
-            mins.push_back(minvec + 2.0f * thirdy + 2.0f * thirdx);                 // Top right front
-            mins.push_back(minvec + 2.0f * thirdy + thirdz);                        // Top left middle
-            mins.push_back(minvec + 2.0f * thirdy + thirdz + 2.0f * thirdx);        // Top right middle
-            mins.push_back(minvec + 2.0f * thirdy + 2.0f * thirdz);                 // Top left back
-            mins.push_back(minvec + 2.0f * thirdy + 2.0f * thirdz + thirdx);        // Top center back
-            mins.push_back(minvec + 2.0f * thirdy + 2.0f * thirdz + 2.0f * thirdx); // Top right back
+Menger::Pattern
+Menger::pattern() const
+{
+	return pattern_;
+}
+
+void
+Menger::set_mesher(Mesher mesher)
+{
+	mesher_ = mesher;
+	dirty_ = true;
+}
+
+Menger::Mesher
+Menger::mesher() const
+{
+	return mesher_;
+}
+
+Menger::Mesher
+Menger::effective_mesher() const
+{
+	return meshed_as(measure(pattern_, nesting_level_), mesher_);
+}
+
+VoxelGrid
+Menger::voxels() const
+{
+    PROFILE_SCOPE("voxelize");
+    uint32_t keep, recurse;
+    rule_masks(pattern_, &keep, &recurse);
+    return VoxelGrid::from_rule(keep, recurse, nesting_level_);
+}
+
+std::vector<Menger::Chunk>
+Menger::chunks() const
+{
+    PROFILE_SCOPE("chunks");
+    uint32_t keep, recurse;
+    rule_masks(pattern_, &keep, &recurse);
+    VoxelGrid grid;
+    VoxelGrid exposed[6];
+    Mesher mesher = effective_mesher();
+    if (mesher == kCulledFaces) {
+        grid = voxels();
+        for (int f = 0; f < 6; f++)
+            exposed[f] = grid.exposed(kFaceAxis[f], kFacePositive[f]);
+    }
+    int lattice = int(std::pow(3.0, nesting_level_) + 0.5);
+    int extent;
+    int cells = top_cells(lattice, &extent);
+    // The soup's recursing cells each hold a whole sponge one level down.
+    uint64_t sub_cubes = nesting_level_ > 0 ? measure(pattern_, nesting_level_ - 1).cubes : 1;
+
+    std::vector<Chunk> result;
+    size_t first_face = 0;
+    for (int cell = 0; cell < cells; cell++) {
+        uint64_t quads = 0;
+        if (mesher == kCubeSoup) {
+            if (cells == 1)
+                quads = 6;
+            else if ((keep >> cell) & 1u)
+                quads = ((recurse >> cell) & 1u) ? sub_cubes * 6 : 6;
+        } else {
+            for (int f = 0; f < 6; f++)
+                quads += exposed[f].count_box(subdivision::cell_x(cell) * extent,
+                                              subdivision::cell_y(cell) * extent,
+                                              subdivision::cell_z(cell) * extent, extent);
         }
+        if (quads == 0)
+            continue;
+        Chunk chunk = top_cell(cells, cell);
+        chunk.first_face = first_face;
+        chunk.face_count = quads * 2;
+        first_face += chunk.face_count;
+        result.push_back(chunk);
+    }
+    return result;
+}
+
+Menger::Chunk
+Menger::top_cell(int cells, int cell) const
+{
+    Chunk chunk;
+    if (cells == 1) {
+        chunk.min = min;
+        chunk.max = max;
+    } else {
+        glm::vec3 size = subdivision::cell_sizes(min, max, 1).back();
+        chunk.min = subdivision::child_min(min, size, cell);
+        chunk.max = chunk.min + size;
     }
+    chunk.first_face = 0;
+    chunk.face_count = 0;
+    return chunk;
+}
+
+const char*
+Menger::pattern_name(Pattern pattern)
+{
+	switch (pattern) {
+	case kJerusalemCube:
+		return "jerusalem";
+	case kMoselySnowflake:
+		return "mosely";
+	default:
+		return "menger";
+	}
+}
+
+uint64_t
+Menger::quad_count() const
+{
+    return quads(measure(pattern_, nesting_level_), mesher_);
+}
+
+Menger::Capacity
+Menger::capacity(Pattern pattern, int level, glm::vec3 min, glm::vec3 max, Mesher mesher)
+{
+    subdivision::Measure m = measure(pattern, level);
+    Capacity c;
+    c.cubes = m.cubes;
+    c.vertices = quads(m, mesher) * 4;
+    c.triangles = quads(m, mesher) * 2;
+    c.normal_bytes = c.vertices * sizeof(glm::vec4);
+    uint64_t vertex_bytes = c.vertices * sizeof(glm::vec4) + c.normal_bytes;
+    c.bytes[kIndex32] = vertex_bytes + c.triangles * 3 * sizeof(uint32_t);
+    c.bytes[kIndex16] = vertex_bytes + c.triangles * 3 * sizeof(uint16_t);
+    c.visible_faces = m.surface_faces;
+    uint64_t cells = uint64_t(std::pow(27.0, level) + 0.5);
+    c.grid_bytes = (cells + 63) / 64 * sizeof(uint64_t);
+
+    // The rules are symmetric, so a third of the surface faces each axis.
+    glm::vec3 e = glm::abs(max - min);
+    double face_cells = std::pow(9.0, level);
+    c.surface_area = m.surface_faces / 3.0 *
+        (double(e.y) * e.z + double(e.x) * e.z + double(e.x) * e.y) / face_cells;
+    c.volume = m.voxels * double(e.x) * e.y * e.z / (face_cells * std::pow(3.0, level));
+    return c;
+}
+
+Menger::Capacity
+Menger::capacity(Pattern pattern, int level) const
+{
+    return capacity(pattern, level, min, max, mesher_);
+}
 
-    glm::vec3 cubeDiag = (max - min) * float(1.0 / pow(3.0f, nesting_level_));
-    for(auto it = mins.begin(); it != mins.end(); ++it)
-        generate_cube(obj_vertices, vtx_normals, obj_faces, *it, *it + cubeDiag);
-
-    std::cout << "Created " << mins.size() << " cubes" << std::endl;
-}
-
-void Menger::generate_cube(std::vector<glm::vec4> &obj_vertices, std::vector<glm::vec4> &vtx_normals,
-                           std::vector<glm::uvec3> &obj_faces, glm::vec3 min, glm::vec3 max) const {
-
-    unsigned long idx = obj_vertices.size();
-    // Front face
-    obj_vertices.push_back(glm::vec4(max.x, min.y, min.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(max.x, max.y, min.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(min.x, max.y, min.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(min.x, min.y, min.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
-
-    obj_faces.push_back(glm::uvec3(idx, idx+ 1, idx + 2));
-    obj_faces.push_back(glm::uvec3(idx, idx + 2, idx + 3));
-
-    // Back face
-    obj_vertices.push_back(glm::vec4(max.x, min.y, max.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(max.x, max.y, max.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(min.x, max.y, max.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(min.x, min.y, max.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
-
-    obj_faces.push_back(glm::uvec3(idx + 4, idx + 5, idx + 6));
-    obj_faces.push_back(glm::uvec3(idx + 4, idx + 6, idx + 7));
-
-    // Right face
-    obj_vertices.push_back(glm::vec4(max.x, min.y, max.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(max.x, max.y, max.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(max.x, max.y, min.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(max.x, min.y, min.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f));
-
-    obj_faces.push_back(glm::uvec3(idx + 8, idx + 9, idx + 10));
-    obj_faces.push_back(glm::uvec3(idx + 8, idx + 10, idx + 11));
-
-
-    // Left face
-    obj_vertices.push_back(glm::vec4(min.x, min.y, max.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(min.x, max.y, max.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(min.x, max.y, min.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(min.x, min.y, min.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f));
-
-    obj_faces.push_back(glm::uvec3(idx + 12, idx + 13, idx + 14));
-    obj_faces.push_back(glm::uvec3(idx + 12, idx + 14, idx + 15));
-
-    // Top face
-    obj_vertices.push_back(glm::vec4(min.x, max.y, max.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(min.x, max.y, min.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(max.x, max.y, min.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(max.x, max.y, max.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
-
-    obj_faces.push_back(glm::uvec3(idx + 16, idx + 17, idx + 18));
-    obj_faces.push_back(glm::uvec3(idx + 16, idx + 18, idx + 19));
-
-    // Bottom face
-    obj_vertices.push_back(glm::vec4(min.x, min.y, max.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(min.x, min.y, min.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(max.x, min.y, min.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
-    obj_vertices.push_back(glm::vec4(max.x, min.y, max.z, 1.0f));
-    vtx_normals.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
-
-    obj_faces.push_back(glm::uvec3(idx + 20, idx + 21, idx + 22));
-    obj_faces.push_back(glm::uvec3(idx + 20, idx + 22, idx + 23));
+size_t
+Menger::vertex_count() const
+{
+    return quad_count() * 4;
 }
 
+size_t
+Menger::face_count() const
+{
+    return quad_count() * 2;
+}
 
+void
+Menger::generate_geometry(std::vector<glm::vec4>& obj_vertices,
+			  std::vector<glm::vec4>& vtx_normals,
+                          std::vector<glm::uvec3>& obj_faces,
+                          std::vector<Chunk>* chunks) const
+{
+    // Output sizes are known up front, so the outputs are sized once and
+    // written in place.
+    size_t vertex_base = obj_vertices.size();
+    size_t face_base = obj_faces.size();
+    obj_vertices.resize(vertex_base + vertex_count());
+    vtx_normals.resize(vertex_base + vertex_count());
+    obj_faces.resize(face_base + face_count());
+
+    generate_geometry(Span<glm::vec4>{ &obj_vertices[vertex_base], vertex_count() },
+                      Span<glm::vec4>{ &vtx_normals[vertex_base], vertex_count() },
+                      Span<glm::uvec3>{ &obj_faces[face_base], face_count() },
+                      uint32_t(vertex_base), chunks);
+}
 
+bool
+Menger::generate_geometry(Span<glm::vec4> obj_vertices,
+                          Span<glm::vec4> vtx_normals,
+                          Span<glm::uvec3> obj_faces,
+                          uint32_t base_vertex,
+                          std::vector<Chunk>* chunks) const
+{
+    if (obj_vertices.size < vertex_count() ||
+        (vtx_normals.data && vtx_normals.size < vertex_count()) ||
+        obj_faces.size < face_count())
+        return false;
+
+    if (chunks)
+        chunks->clear();
+    if (effective_mesher() == kCubeSoup)
+        generate_cubes(obj_vertices.data, vtx_normals.data, obj_faces.data, base_vertex,
+                       chunks);
+    else
+        generate_culled(obj_vertices.data, vtx_normals.data, obj_faces.data, base_vertex,
+                        chunks);
+    return true;
+}
+
+void
+Menger::generate_cubes(glm::vec4* vertices, glm::vec4* normals,
+                       glm::uvec3* faces, uint32_t base_vertex,
+                       std::vector<Chunk>* chunks) const
+{
+    PROFILE_SCOPE("mesh soup");
+    FaceWriter writer = { vertices, normals, faces, base_vertex };
+    switch (pattern_) {
+    case kJerusalemCube:
+        subdivision::subdivide<subdivision::JerusalemRule>(min, max, nesting_level_, writer);
+        break;
+    case kMoselySnowflake:
+        subdivision::subdivide<subdivision::MoselyRule>(min, max, nesting_level_, writer);
+        break;
+    default:
+        subdivision::subdivide<subdivision::MengerRule>(min, max, nesting_level_, writer);
+        break;
+    }
+
+    // The soup's chunks follow from the rule alone, without voxelizing.
+    if (chunks)
+        *chunks = this->chunks();
+    std::cout << "Created " << quad_count() / 6 << " cubes" << std::endl;
+}
+
+// Walks the occupied cells that have at least one exposed face, up to a
+// word of a grid row at a time, and writes those faces in the cube's face
+// order. A single cell is therefore meshed exactly like the original cube.
+// Cells are visited by top-level cell so that chunks() are contiguous,
+// and each one's faces are recorded as they are written.
+void
+Menger::generate_culled(glm::vec4* vertices, glm::vec4* normals,
+                        glm::uvec3* faces, uint32_t base_vertex,
+                        std::vector<Chunk>* chunks) const
+{
+    PROFILE_SCOPE("mesh culled");
+    VoxelGrid grid = voxels();
+    int n = grid.size();
+    VoxelGrid exposed[6];
+    for (int f = 0; f < 6; f++)
+        exposed[f] = grid.exposed(kFaceAxis[f], kFacePositive[f]);
+
+    // Lattice planes per axis. Neighboring faces share the same values, and
+    // the outer planes are exactly min and max.
+    glm::vec3 size = subdivision::cell_sizes(min, max, nesting_level_).back();
+    std::vector<glm::vec3> planes(n + 1);
+    for (int i = 0; i < n; i++)
+        planes[i] = min + float(i) * size;
+    planes[n] = max;
+
+    FaceWriter writer = { vertices, normals, faces, base_vertex };
+    int extent;
+    int cells = top_cells(n, &extent);
+    for (int cell = 0; cell < cells; cell++) {
+        int x0 = subdivision::cell_x(cell) * extent;
+        int y0 = subdivision::cell_y(cell) * extent;
+        int z0 = subdivision::cell_z(cell) * extent;
+        glm::uvec3* cell_faces = writer.faces;
+        for (int y = y0; y < y0 + extent; y++) {
+            for (int z = z0; z < z0 + extent; z++) {
+                for (int x = x0; x < x0 + extent; x += 64) {
+                    int count = std::min(64, x0 + extent - x);
+                    uint64_t rows[6];
+                    uint64_t any = 0;
+                    for (int f = 0; f < 6; f++) {
+                        rows[f] = exposed[f].row(x, y, z, count);
+                        any |= rows[f];
+                    }
+                    while (any) {
+                        int bit = __builtin_ctzll(any);
+                        any &= any - 1;
+                        int cx = x + bit;
+                        glm::vec3 cube_min(planes[cx].x, planes[y].y, planes[z].z);
+                        glm::vec3 cube_max(planes[cx + 1].x, planes[y + 1].y, planes[z + 1].z);
+                        for (int f = 0; f < 6; f++)
+                            if ((rows[f] >> bit) & 1u)
+                                writer.face(cube_min, cube_max, f);
+                    }
+                }
+            }
+        }
+        if (chunks && writer.faces != cell_faces) {
+            Chunk chunk = top_cell(cells, cell);
+            chunk.first_face = cell_faces - faces;
+            chunk.face_count = writer.faces - cell_faces;
+            chunks->push_back(chunk);
+        }
+    }
+
+    std::cout << "Meshed " << quad_count() << " faces from " << grid.count()
+              << " voxels" << std::endl;
+}
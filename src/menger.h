@@ -1,27 +1,108 @@
 #ifndef MENGER_H
 #define MENGER_H
 
+#include <cstddef>
+#include <cstdint>
 #include <glm/glm.hpp>
 #include <vector>
+#include "voxel_grid.h"
+
+// Caller-owned output storage, e.g. a mapped GL buffer.
+template <typename T>
+struct Span {
+	T* data;
+	size_t size;
+};
 
 class Menger {
 public:
+	// Subdivision rule applied at every level, see subdivision.h.
+	enum Pattern { kMengerSponge, kJerusalemCube, kMoselySnowflake, kNumPatterns };
+	// Index formats the sponge buffers can be uploaded with.
+	enum IndexFormat { kIndex32, kIndex16, kNumIndexFormats };
+	// How the solid is turned into triangles. Culled faces meshes only the
+	// cell faces on the surface of the voxel grid; the cube soup emits all
+	// six faces of every leaf cube, as the original generator did. Levels
+	// whose culled faces outnumber the soup's, as where the Jerusalem
+	// cube's solid beams are split into lattice faces, use the soup.
+	enum Mesher { kCulledFaces, kCubeSoup };
+
+	// What a level costs, computed in O(level) without generating it.
+	struct Capacity {
+		uint64_t cubes;
+		uint64_t vertices;
+		uint64_t triangles;
+		uint64_t bytes[kNumIndexFormats];  // vertex, normal and index buffers
+		uint64_t normal_bytes;   // the part of bytes that is normals
+		uint64_t visible_faces;  // faces of the level's lattice on the surface
+		uint64_t grid_bytes;     // packed voxel grid
+		double surface_area;
+		double volume;
+	};
+	// A contiguous run of generate_geometry's faces covering one top-level
+	// cell of the sponge (or all of it at level 0), with the cell's bounds.
+	struct Chunk {
+		glm::vec3 min, max;
+		size_t first_face;
+		size_t face_count;
+	};
+	static const char* pattern_name(Pattern pattern);
+	static Capacity capacity(Pattern pattern, int level, glm::vec3 min, glm::vec3 max,
+	                         Mesher mesher = kCulledFaces);
+	Capacity capacity(Pattern pattern, int level) const;
+
 	Menger(glm::vec3 min, glm::vec3 max);
 	~Menger();
 	void set_nesting_level(int);
+	int nesting_level() const;
+	void set_pattern(Pattern);
+	Pattern pattern() const;
+	void set_mesher(Mesher);
+	Mesher mesher() const;
+	// The mesher the current pattern and level are generated with.
+	Mesher effective_mesher() const;
+	// Occupancy of the current pattern and level on its 3^level lattice.
+	VoxelGrid voxels() const;
+	// The non-empty chunks of what generate_geometry writes, in order.
+	// generate_geometry can record them as it goes, which is cheaper.
+	std::vector<Chunk> chunks() const;
 	bool is_dirty() const;
 	void set_clean();
+	// If `chunks` is given it is replaced with the chunks written, their
+	// faces counted from the first face this call appends.
 	void generate_geometry(std::vector<glm::vec4>& obj_vertices,
 			       std::vector<glm::vec4>& vtx_normals,
-	                       std::vector<glm::uvec3>& obj_faces) const;
+	                       std::vector<glm::uvec3>& obj_faces,
+	                       std::vector<Chunk>* chunks = nullptr) const;
+
+	// Exact output sizes of generate_geometry for the current level,
+	// pattern and mesher, so callers can size their storage up front.
+	size_t vertex_count() const;
+	size_t face_count() const;
+	// Writes the geometry into caller storage without allocating. Face
+	// indices start at base_vertex. Normals are skipped if vtx_normals has
+	// no data. Returns false, writing nothing, if a span is smaller than
+	// vertex_count() or face_count().
+	bool generate_geometry(Span<glm::vec4> obj_vertices,
+	                       Span<glm::vec4> vtx_normals,
+	                       Span<glm::uvec3> obj_faces,
+	                       uint32_t base_vertex = 0,
+	                       std::vector<Chunk>* chunks = nullptr) const;
 private:
 	int nesting_level_ = 0;
+	Pattern pattern_ = kMengerSponge;
+	Mesher mesher_ = kCulledFaces;
 	bool dirty_ = false;
 
-    void generate_cube(std::vector<glm::vec4>& obj_vertices,
-                       std::vector<glm::vec4>& vtx_normals,
-                       std::vector<glm::uvec3>& obj_faces,
-                       glm::vec3 min, glm::vec3 max) const;
+	uint64_t quad_count() const;
+	// Top-level cell `cell` of `cells` as a chunk with no faces yet.
+	Chunk top_cell(int cells, int cell) const;
+	void generate_cubes(glm::vec4* vertices, glm::vec4* normals,
+	                    glm::uvec3* faces, uint32_t base_vertex,
+	                    std::vector<Chunk>* chunks) const;
+	void generate_culled(glm::vec4* vertices, glm::vec4* normals,
+	                     glm::uvec3* faces, uint32_t base_vertex,
+	                     std::vector<Chunk>* chunks) const;
 
     glm::vec3 min, max;
 };
@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include "mesh_optimizer.h"
+
+namespace {
+	// Forsyth's tuning constants.
+	const int kCacheSize = 32;
+	const float kCacheDecayPower = 1.5f;
+	const float kLastTriScore = 0.75f;
+	const float kValenceBoostScale = 2.0f;
+	const float kValenceBoostPower = 0.5f;
+
+	float vertex_score(int cache_position, int remaining)
+	{
+		if (remaining == 0)
+			return -1.0f;
+
+		float score = 0.0f;
+		if (cache_position < 0) {
+			// Not in the cache.
+		} else if (cache_position < 3) {
+			// Used by the last triangle; a fixed score keeps strips from
+			// being favoured over fans.
+			score = kLastTriScore;
+		} else {
+			float scaler = 1.0f / (kCacheSize - 3);
+			score = std::pow(1.0f - (cache_position - 3) * scaler, kCacheDecayPower);
+		}
+		// Finish off vertices with few triangles left first.
+		score += kValenceBoostScale * std::pow(float(remaining), -kValenceBoostPower);
+		return score;
+	}
+};
+
+CacheStats
+analyze_vertex_cache(const std::vector<glm::uvec3>& faces, size_t vertex_count,
+                     unsigned cache_size)
+{
+	std::vector<bool> in_cache(vertex_count, false);
+	std::vector<bool> referenced(vertex_count, false);
+	std::deque<uint32_t> fifo;
+	size_t misses = 0;
+	size_t unique = 0;
+
+	for (const glm::uvec3& face : faces) {
+		for (int k = 0; k < 3; k++) {
+			uint32_t v = face[k];
+			if (!referenced[v]) {
+				referenced[v] = true;
+				unique++;
+			}
+			if (in_cache[v])
+				continue;
+			misses++;
+			fifo.push_back(v);
+			in_cache[v] = true;
+			if (fifo.size() > cache_size) {
+				in_cache[fifo.front()] = false;
+				fifo.pop_front();
+			}
+		}
+	}
+
+	CacheStats stats = { 0.0, 0.0 };
+	if (!faces.empty())
+		stats.acmr = double(misses) / faces.size();
+	if (unique > 0)
+		stats.atvr = double(misses) / unique;
+	return stats;
+}
+
+void
+optimize_vertex_cache(std::vector<glm::uvec3>& faces, size_t vertex_count)
+{
+	size_t face_count = faces.size();
+	if (face_count == 0)
+		return;
+
+	// Triangle adjacency per vertex, compacted as triangles are emitted.
+	std::vector<uint32_t> adjacency_offset(vertex_count + 1, 0);
+	for (const glm::uvec3& face : faces)
+		for (int k = 0; k < 3; k++)
+			adjacency_offset[face[k] + 1]++;
+	for (size_t v = 0; v < vertex_count; v++)
+		adjacency_offset[v + 1] += adjacency_offset[v];
+	std::vector<uint32_t> remaining(vertex_count);
+	for (size_t v = 0; v < vertex_count; v++)
+		remaining[v] = adjacency_offset[v + 1] - adjacency_offset[v];
+
+	std::vector<uint32_t> adjacency(adjacency_offset[vertex_count]);
+	std::vector<uint32_t> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+	for (size_t f = 0; f < face_count; f++)
+		for (int k = 0; k < 3; k++)
+			adjacency[fill[faces[f][k]]++] = f;
+
+	std::vector<int> cache_position(vertex_count, -1);
+	std::vector<float> score(vertex_count);
+	for (size_t v = 0; v < vertex_count; v++)
+		score[v] = vertex_score(-1, remaining[v]);
+
+	std::vector<float> face_score(face_count);
+	std::vector<bool> emitted(face_count, false);
+	for (size_t f = 0; f < face_count; f++)
+		face_score[f] = score[faces[f].x] + score[faces[f].y] + score[faces[f].z];
+
+	std::vector<glm::uvec3> result;
+	result.reserve(face_count);
+	std::vector<uint32_t> cache;
+	std::vector<uint32_t> next_cache;
+	size_t scan = 0;
+	long best = std::max_element(face_score.begin(), face_score.end()) - face_score.begin();
+
+	while (result.size() < face_count) {
+		if (best < 0) {
+			// Nothing in the cache has work left; continue in input order.
+			while (emitted[scan])
+				scan++;
+			best = scan;
+		}
+		const glm::uvec3 face = faces[best];
+		emitted[best] = true;
+		result.push_back(face);
+
+		// Retire the triangle from its vertices' adjacency.
+		for (int k = 0; k < 3; k++) {
+			uint32_t v = face[k];
+			uint32_t* begin = &adjacency[adjacency_offset[v]];
+			uint32_t* end = begin + remaining[v];
+			std::iter_swap(std::find(begin, end, uint32_t(best)), end - 1);
+			remaining[v]--;
+		}
+
+		// Move the triangle's vertices to the front of the LRU cache.
+		next_cache.assign(&face[0], &face[0] + 3);
+		for (uint32_t v : cache)
+			if (v != face.x && v != face.y && v != face.z)
+				next_cache.push_back(v);
+		cache.swap(next_cache);
+
+		// Rescore everything whose cache position changed, then the
+		// triangles touching it, tracking the best candidate.
+		best = -1;
+		float best_score = -1.0f;
+		for (size_t i = 0; i < cache.size(); i++) {
+			uint32_t v = cache[i];
+			cache_position[v] = i < size_t(kCacheSize) ? int(i) : -1;
+			score[v] = vertex_score(cache_position[v], remaining[v]);
+		}
+		for (size_t i = 0; i < cache.size(); i++) {
+			uint32_t v = cache[i];
+			for (uint32_t j = 0; j < remaining[v]; j++) {
+				uint32_t f = adjacency[adjacency_offset[v] + j];
+				face_score[f] = score[faces[f].x] + score[faces[f].y] + score[faces[f].z];
+				if (face_score[f] > best_score) {
+					best_score = face_score[f];
+					best = f;
+				}
+			}
+		}
+		if (cache.size() > size_t(kCacheSize))
+			cache.resize(kCacheSize);
+	}
+	faces.swap(result);
+}
+
+void
+optimize_vertex_fetch(std::vector<glm::vec4>& vertices,
+                      std::vector<glm::vec4>& normals,
+                      std::vector<glm::uvec3>& faces)
+{
+	const uint32_t kUnused = ~0u;
+	std::vector<uint32_t> remap(vertices.size(), kUnused);
+	std::vector<glm::vec4> new_vertices;
+	std::vector<glm::vec4> new_normals;
+	new_vertices.reserve(vertices.size());
+	new_normals.reserve(normals.size());
+
+	for (glm::uvec3& face : faces) {
+		for (int k = 0; k < 3; k++) {
+			uint32_t& slot = remap[face[k]];
+			if (slot == kUnused) {
+				slot = new_vertices.size();
+				new_vertices.push_back(vertices[face[k]]);
+				if (!normals.empty())
+					new_normals.push_back(normals[face[k]]);
+			}
+			face[k] = slot;
+		}
+	}
+	vertices.swap(new_vertices);
+	normals.swap(new_normals);
+}
+
+std::vector<IndexRange>
+build_short_ranges(const std::vector<glm::uvec3>& faces, std::vector<uint16_t>& indices)
+{
+	const uint32_t kMaxSpan = 0xffff;
+	std::vector<IndexRange> ranges;
+	indices.resize(faces.size() * 3);
+
+	size_t first = 0;
+	while (first < faces.size()) {
+		// Grow the run while its vertex span fits in 16 bits.
+		uint32_t lo = std::min(faces[first].x, std::min(faces[first].y, faces[first].z));
+		uint32_t hi = std::max(faces[first].x, std::max(faces[first].y, faces[first].z));
+		size_t last = first + 1;
+		for (; last < faces.size(); last++) {
+			const glm::uvec3& face = faces[last];
+			uint32_t face_lo = std::min(face.x, std::min(face.y, face.z));
+			uint32_t face_hi = std::max(face.x, std::max(face.y, face.z));
+			if (std::max(hi, face_hi) - std::min(lo, face_lo) > kMaxSpan)
+				break;
+			lo = std::min(lo, face_lo);
+			hi = std::max(hi, face_hi);
+		}
+
+		for (size_t f = first; f < last; f++)
+			for (int k = 0; k < 3; k++)
+				indices[f * 3 + k] = uint16_t(faces[f][k] - lo);
+		IndexRange range = { first * 3, (last - first) * 3, lo };
+		ranges.push_back(range);
+		first = last;
+	}
+	return ranges;
+}
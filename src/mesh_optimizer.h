@@ -0,0 +1,46 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Post-transform vertex cache efficiency of an index stream, simulated with
+// a FIFO cache. ACMR is cache misses per triangle (0.5 is ideal for large
+// regular grids, 3.0 means no reuse); ATVR is misses per referenced vertex
+// (1.0 is ideal).
+struct CacheStats {
+	double acmr;
+	double atvr;
+};
+
+// A run of indices that can be drawn with glDrawElementsBaseVertex.
+struct IndexRange {
+	size_t first_index;
+	size_t index_count;
+	uint32_t base_vertex;
+};
+
+CacheStats analyze_vertex_cache(const std::vector<glm::uvec3>& faces,
+                                size_t vertex_count,
+                                unsigned cache_size = 16);
+
+// Reorders triangles for post-transform cache reuse using Tom Forsyth's
+// "Linear-Speed Vertex Cache Optimisation".
+void optimize_vertex_cache(std::vector<glm::uvec3>& faces, size_t vertex_count);
+
+// Reorders vertices (and normals) by first use in the index stream so the
+// vertex fetch walks memory linearly, and remaps the faces. Unreferenced
+// vertices are dropped.
+void optimize_vertex_fetch(std::vector<glm::vec4>& vertices,
+                           std::vector<glm::vec4>& normals,
+                           std::vector<glm::uvec3>& faces);
+
+// Splits the index stream into runs whose vertices fit in 16 bits relative
+// to the run's base vertex, writing the rebased indices to `indices`.
+// Works best after optimize_vertex_fetch, which keeps runs long.
+std::vector<IndexRange> build_short_ranges(const std::vector<glm::uvec3>& faces,
+                                           std::vector<uint16_t>& indices);
+
+#endif
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <debuggl.h>
+#include "profiler.h"
+
+Profiler g_profiler;
+
+namespace {
+	// Keeps a long session's trace to a few tens of MB.
+	const size_t kMaxEvents = 1 << 20;
+};
+
+void
+Profiler::enable(bool gpu)
+{
+	enabled_ = true;
+	gpu_ = gpu;
+	epoch_ = std::chrono::steady_clock::now();
+}
+
+double
+Profiler::now() const
+{
+	std::chrono::duration<double, std::micro> elapsed =
+		std::chrono::steady_clock::now() - epoch_;
+	return elapsed.count();
+}
+
+void
+Profiler::record(const char* name, double start, double duration, bool gpu)
+{
+	Stats& s = stats_[std::make_pair(std::string(name), gpu)];
+	s.count++;
+	s.total_ms += duration / 1000.0;
+	s.max_ms = std::max(s.max_ms, duration / 1000.0);
+	if (events_.size() < kMaxEvents) {
+		Event event = { name, start, duration, gpu };
+		events_.push_back(event);
+	} else {
+		dropped_++;
+	}
+}
+
+void
+Profiler::add_cpu(const char* name, double start, double end)
+{
+	record(name, start, end - start, false);
+}
+
+void
+Profiler::begin_gpu(const char* name)
+{
+	if (gpu_depth_++ > 0)
+		return;
+	Query query = { name, now(), 0 };
+	if (free_queries_.empty()) {
+		CHECK_GL_ERROR(glGenQueries(1, &query.id));
+	} else {
+		query.id = free_queries_.back();
+		free_queries_.pop_back();
+	}
+	CHECK_GL_ERROR(glBeginQuery(GL_TIME_ELAPSED, query.id));
+	queries_[current_].push_back(query);
+}
+
+void
+Profiler::end_gpu()
+{
+	if (--gpu_depth_ > 0)
+		return;
+	CHECK_GL_ERROR(glEndQuery(GL_TIME_ELAPSED));
+}
+
+// Reads the results of `queries`, which blocks only if the GPU is still
+// behind, and returns the query objects for reuse.
+void
+Profiler::collect(std::vector<Query>& queries)
+{
+	for (const Query& query : queries) {
+		GLuint64 nanoseconds = 0;
+		CHECK_GL_ERROR(glGetQueryObjectui64v(query.id, GL_QUERY_RESULT, &nanoseconds));
+		record(query.name, query.submitted, nanoseconds / 1000.0, true);
+		free_queries_.push_back(query.id);
+	}
+	queries.clear();
+}
+
+void
+Profiler::end_frame()
+{
+	if (!enabled_)
+		return;
+	frames_++;
+	current_ ^= 1;
+	collect(queries_[current_]);
+}
+
+void
+Profiler::finish()
+{
+	if (!enabled_)
+		return;
+	collect(queries_[current_ ^ 1]);
+	collect(queries_[current_]);
+	if (!free_queries_.empty())
+		CHECK_GL_ERROR(glDeleteQueries(free_queries_.size(), free_queries_.data()));
+	free_queries_.clear();
+}
+
+Profiler::Stats
+Profiler::stats(const char* name, bool gpu) const
+{
+	auto found = stats_.find(std::make_pair(std::string(name), gpu));
+	return found == stats_.end() ? Stats() : found->second;
+}
+
+double
+Profiler::total_ms(bool gpu) const
+{
+	double total = 0.0;
+	for (const auto& entry : stats_)
+		if (entry.first.second == gpu)
+			total += entry.second.total_ms;
+	return total;
+}
+
+void
+Profiler::print_summary(std::ostream& out) const
+{
+	out << "Profile over " << frames_ << " frames:\n"
+	    << std::setw(16) << "stage" << std::setw(6) << "on"
+	    << std::setw(10) << "calls" << std::setw(12) << "avg ms"
+	    << std::setw(12) << "max ms" << std::setw(12) << "total ms" << "\n";
+	for (const auto& entry : stats_) {
+		const Stats& s = entry.second;
+		out << std::setw(16) << entry.first.first
+		    << std::setw(6) << (entry.first.second ? "gpu" : "cpu")
+		    << std::setw(10) << s.count
+		    << std::setw(12) << s.total_ms / s.count
+		    << std::setw(12) << s.max_ms
+		    << std::setw(12) << s.total_ms << "\n";
+	}
+	if (dropped_ > 0)
+		out << dropped_ << " events left out of the trace\n";
+}
+
+// Complete ("X") events in the Chrome trace event format, with CPU and GPU
+// on separate tracks.
+bool
+Profiler::write_trace(const std::string& path) const
+{
+	std::ofstream file(path);
+	if (!file) {
+		std::cerr << "Cannot write trace to " << path << "\n";
+		return false;
+	}
+	file << std::fixed << std::setprecision(3);
+	file << "{\"traceEvents\":[\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+	     << "\"args\":{\"name\":\"CPU\"}},\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,"
+	     << "\"args\":{\"name\":\"GPU\"}}";
+	for (const Event& event : events_) {
+		file << ",\n{\"name\":\"" << event.name << "\",\"cat\":\""
+		     << (event.gpu ? "gpu" : "cpu") << "\",\"ph\":\"X\",\"ts\":" << event.start
+		     << ",\"dur\":" << event.duration << ",\"pid\":1,\"tid\":"
+		     << (event.gpu ? 2 : 1) << "}";
+	}
+	file << "\n]}\n";
+	file.close();
+	if (!file) {
+		std::cerr << "Failed writing trace to " << path << "\n";
+		return false;
+	}
+	std::cout << "Wrote " << events_.size() << " trace events to " << path << "\n";
+	return true;
+}
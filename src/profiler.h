@@ -0,0 +1,120 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <GL/glew.h>
+
+// Times named stages on the CPU and, with GL_TIME_ELAPSED queries, on the
+// GPU. Prints a per-stage summary and writes a Chrome trace that
+// chrome://tracing or Perfetto can open.
+//
+// Disabled, each scope costs one test of a flag. GPU queries are double
+// buffered: a frame's results are read at the end of the following frame,
+// by which time the GPU has finished them. Elapsed-time queries cannot
+// nest, so neither can GPU scopes; an inner one is ignored. GPU events
+// appear in the trace at the time they were submitted.
+class Profiler {
+public:
+	struct Stats {
+		unsigned long count = 0;
+		double total_ms = 0.0;
+		double max_ms = 0.0;
+	};
+
+	// Starts recording. GPU scopes need a current GL context.
+	void enable(bool gpu);
+	bool enabled() const { return enabled_; }
+	bool gpu_enabled() const { return gpu_; }
+
+	// Microseconds since enable().
+	double now() const;
+	void add_cpu(const char* name, double start, double end);
+	void begin_gpu(const char* name);
+	void end_gpu();
+	// Closes a frame and collects the GPU times of the frame before it.
+	void end_frame();
+	// Collects every outstanding GPU time, waiting for the GPU if needed.
+	void finish();
+
+	// Zero counts for a stage never timed.
+	Stats stats(const char* name, bool gpu) const;
+	// Summed over every stage on the CPU or the GPU. Nested CPU scopes are
+	// counted twice; GPU scopes never nest.
+	double total_ms(bool gpu) const;
+	void print_summary(std::ostream& out) const;
+	bool write_trace(const std::string& path) const;
+private:
+	struct Event {
+		const char* name;
+		double start, duration;  // microseconds
+		bool gpu;
+	};
+	struct Query {
+		const char* name;
+		double submitted;
+		GLuint id;
+	};
+
+	void record(const char* name, double start, double duration, bool gpu);
+	void collect(std::vector<Query>& queries);
+
+	bool enabled_ = false;
+	bool gpu_ = false;
+	std::chrono::steady_clock::time_point epoch_;
+	std::map<std::pair<std::string, bool>, Stats> stats_;
+	std::vector<Event> events_;
+	unsigned long dropped_ = 0;
+
+	std::vector<GLuint> free_queries_;
+	std::vector<Query> queries_[2];  // issued this frame and the frame before
+	int current_ = 0;
+	int gpu_depth_ = 0;              // open GPU scopes; only the outer one times
+	unsigned long frames_ = 0;
+};
+
+extern Profiler g_profiler;
+
+// Adds the time between construction and destruction to the profiler.
+class ProfileScope {
+public:
+	explicit ProfileScope(const char* name)
+		: name_(name), start_(g_profiler.enabled() ? g_profiler.now() : -1.0) {}
+	~ProfileScope()
+	{
+		if (start_ >= 0.0)
+			g_profiler.add_cpu(name_, start_, g_profiler.now());
+	}
+private:
+	const char* name_;
+	double start_;
+};
+
+// Times the GL commands issued between construction and destruction.
+class GpuProfileScope {
+public:
+	explicit GpuProfileScope(const char* name) : active_(g_profiler.gpu_enabled())
+	{
+		if (active_)
+			g_profiler.begin_gpu(name);
+	}
+	~GpuProfileScope()
+	{
+		if (active_)
+			g_profiler.end_gpu();
+	}
+private:
+	bool active_;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) \
+	GpuProfileScope PROFILE_CONCAT(gpu_profile_scope_, __LINE__)(name)
+
+#endif
@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sys/stat.h>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <debuggl.h>
+#include "program_cache.h"
+
+namespace {
+	const char kMagic[4] = { 'M', 'G', 'P', 'B' };
+
+	uint64_t fnv1a(const std::string& data, uint64_t hash = 14695981039346656037ULL)
+	{
+		for (unsigned char c : data) {
+			hash ^= c;
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	std::string gl_string(GLenum name)
+	{
+		const GLubyte* str = glGetString(name);
+		return str ? reinterpret_cast<const char*>(str) : "";
+	}
+};
+
+ProgramCache::ProgramCache(const std::string& directory)
+	: directory_(directory)
+{
+	driver_ = gl_string(GL_VENDOR) + "|" + gl_string(GL_RENDERER) + "|" +
+	          gl_string(GL_VERSION) + "|" + gl_string(GL_SHADING_LANGUAGE_VERSION);
+
+	GLint formats = 0;
+	if (GLEW_ARB_get_program_binary)
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	glGetError();
+	if (formats <= 0) {
+		std::cout << "Program binary cache: not supported by driver\n";
+		return;
+	}
+
+	mkdir(directory_.c_str(), 0755);
+	struct stat st;
+	enabled_ = stat(directory_.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+	if (!enabled_)
+		std::cerr << "Program binary cache: cannot use " << directory_ << "\n";
+}
+
+std::string
+ProgramCache::key(const std::vector<ShaderStage>& stages,
+                  const std::vector<std::string>& attributes) const
+{
+	uint64_t hash = fnv1a(driver_);
+	for (const ShaderStage& stage : stages) {
+		hash = fnv1a(std::to_string(stage.type), hash);
+		hash = fnv1a(stage.source, hash);
+	}
+	for (const std::string& attribute : attributes)
+		hash = fnv1a(attribute + ";", hash);
+
+	char hex[17];
+	snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+	return hex;
+}
+
+GLuint
+ProgramCache::link(const std::vector<ShaderStage>& stages,
+                   const std::vector<std::string>& attributes)
+{
+	if (!enabled_)
+		return compile(stages, attributes);
+
+	std::string path = directory_ + "/" + key(stages, attributes) + ".bin";
+	GLuint program_id = 0;
+	CHECK_GL_ERROR(program_id = glCreateProgram());
+	if (load(program_id, path)) {
+		hits_++;
+		return program_id;
+	}
+	CHECK_GL_ERROR(glDeleteProgram(program_id));
+
+	misses_++;
+	program_id = compile(stages, attributes);
+	store(program_id, path);
+	return program_id;
+}
+
+bool
+ProgramCache::load(GLuint program_id, const std::string& path) const
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		return false;
+
+	char magic[4];
+	GLenum format = 0;
+	in.read(magic, sizeof(magic));
+	in.read(reinterpret_cast<char*>(&format), sizeof(format));
+	if (!in || !std::equal(magic, magic + 4, kMagic))
+		return false;
+	std::string binary((std::istreambuf_iterator<char>(in)),
+	                   std::istreambuf_iterator<char>());
+	if (binary.empty())
+		return false;
+
+	glProgramBinary(program_id, format, binary.data(), binary.size());
+	GLint status = GL_FALSE;
+	glGetProgramiv(program_id, GL_LINK_STATUS, &status);
+	glGetError();
+	if (status != GL_TRUE) {
+		// Driver update or a corrupt file; rebuild from source.
+		std::remove(path.c_str());
+		return false;
+	}
+	return true;
+}
+
+void
+ProgramCache::store(GLuint program_id, const std::string& path) const
+{
+	GLint length = 0;
+	CHECK_GL_ERROR(glGetProgramiv(program_id, GL_PROGRAM_BINARY_LENGTH, &length));
+	if (length <= 0)
+		return;
+
+	std::string binary(length, 0);
+	GLenum format = 0;
+	CHECK_GL_ERROR(glGetProgramBinary(program_id, length, nullptr, &format, &binary[0]));
+
+	// Write to a temporary first so a concurrent run never sees half a file.
+	std::string tmp = path + ".tmp";
+	{
+		std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+		out.write(kMagic, sizeof(kMagic));
+		out.write(reinterpret_cast<const char*>(&format), sizeof(format));
+		out.write(binary.data(), binary.size());
+		if (!out) {
+			std::remove(tmp.c_str());
+			return;
+		}
+	}
+	std::rename(tmp.c_str(), path.c_str());
+}
+
+GLuint
+ProgramCache::compile(const std::vector<ShaderStage>& stages,
+                      const std::vector<std::string>& attributes) const
+{
+	GLuint program_id = 0;
+	CHECK_GL_ERROR(program_id = glCreateProgram());
+
+	std::vector<GLuint> shader_ids;
+	bool has_fragment = false;
+	for (const ShaderStage& stage : stages) {
+		has_fragment = has_fragment || stage.type == GL_FRAGMENT_SHADER;
+		GLuint shader_id = 0;
+		CHECK_GL_ERROR(shader_id = glCreateShader(stage.type));
+		CHECK_GL_ERROR(glShaderSource(shader_id, 1, &stage.source, nullptr));
+		glCompileShader(shader_id);
+		CHECK_GL_SHADER_ERROR(shader_id);
+		CHECK_GL_ERROR(glAttachShader(program_id, shader_id));
+		shader_ids.push_back(shader_id);
+	}
+
+	for (size_t i = 0; i < attributes.size(); i++)
+		CHECK_GL_ERROR(glBindAttribLocation(program_id, i, attributes[i].c_str()));
+	if (has_fragment)
+		CHECK_GL_ERROR(glBindFragDataLocation(program_id, 0, "fragment_color"));
+	if (enabled_)
+		CHECK_GL_ERROR(glProgramParameteri(program_id,
+		               GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+	glLinkProgram(program_id);
+	CHECK_GL_PROGRAM_ERROR(program_id);
+
+	for (GLuint shader_id : shader_ids) {
+		CHECK_GL_ERROR(glDetachShader(program_id, shader_id));
+		CHECK_GL_ERROR(glDeleteShader(shader_id));
+	}
+	return program_id;
+}
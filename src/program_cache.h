@@ -0,0 +1,46 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+
+struct ShaderStage {
+	GLenum type;
+	const char* source;
+};
+
+// Links GLSL programs, reusing the driver's program binaries from a previous
+// run when both the sources and the driver are unchanged.
+//
+// Binaries are stored as <directory>/<key>.bin where key is a hash of the
+// GL vendor/renderer/version strings, the shader sources and the attribute
+// bindings. A binary the driver rejects is dropped and rebuilt from source.
+class ProgramCache {
+public:
+	explicit ProgramCache(const std::string& directory);
+
+	// Attribute i of `attributes` is bound to location i, and
+	// "fragment_color" to draw buffer 0.
+	GLuint link(const std::vector<ShaderStage>& stages,
+	            const std::vector<std::string>& attributes);
+
+	bool enabled() const { return enabled_; }
+	int hits() const { return hits_; }
+	int misses() const { return misses_; }
+private:
+	std::string key(const std::vector<ShaderStage>& stages,
+	                const std::vector<std::string>& attributes) const;
+	bool load(GLuint program, const std::string& path) const;
+	void store(GLuint program, const std::string& path) const;
+	GLuint compile(const std::vector<ShaderStage>& stages,
+	               const std::vector<std::string>& attributes) const;
+
+	std::string directory_;
+	std::string driver_;
+	bool enabled_ = false;
+	int hits_ = 0;
+	int misses_ = 0;
+};
+
+#endif
@@ -0,0 +1,240 @@
+#ifndef SUBDIVISION_H
+#define SUBDIVISION_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Compile-time 3x3x3 subdivision engine shared by the sponge variants.
+//
+// A rule is a pair of 27-bit cell masks: `Keep` selects the cells that
+// survive a subdivision step and `Recurse` the kept cells that are subdivided
+// again. Kept cells that do not recurse stay solid. Cells are numbered
+// x + 3 * z + 9 * y, i.e. bottom layer first, front to back, left to right.
+namespace subdivision {
+
+constexpr int cell_x(int cell) { return cell % 3; }
+constexpr int cell_y(int cell) { return cell / 9; }
+constexpr int cell_z(int cell) { return (cell / 3) % 3; }
+
+// Number of coordinates of `cell` that lie in the middle slab.
+constexpr int centered(int cell)
+{
+	return (cell_x(cell) == 1) + (cell_y(cell) == 1) + (cell_z(cell) == 1);
+}
+
+// Mask of the cells with 0 (corners), 1 (edges), 2 (faces) or 3 (center)
+// centered coordinates, selected by the corresponding flag.
+constexpr uint32_t mask_by_centered(bool corners, bool edges, bool faces,
+                                    bool center, int cell = 0)
+{
+	return cell == 27 ? 0u :
+		((centered(cell) == 0 ? corners :
+		  centered(cell) == 1 ? edges :
+		  centered(cell) == 2 ? faces : center) ? 1u << cell : 0u) |
+		mask_by_centered(corners, edges, faces, center, cell + 1);
+}
+
+constexpr int popcount(uint32_t mask)
+{
+	return mask == 0 ? 0 : int(mask & 1u) + popcount(mask >> 1);
+}
+
+// Size of a rule's solid after some steps, without generating it. Counts
+// are in cells and faces of the finest lattice (3^level cells per side).
+struct Measure {
+	uint64_t cubes;          // leaf cubes emitted by the engine
+	uint64_t voxels;         // occupied lattice cells
+	uint64_t surface_faces;  // lattice faces on the boundary of the solid
+};
+
+// Evaluates the rule's recurrences in O(level). The surface count assumes
+// the masks are symmetric under the cube's reflections, as every mask built
+// by mask_by_centered is: two face-adjacent children then hide exactly the
+// overlap of their boundary patterns, which is the smaller pattern.
+// Exact up to level 13, where 27^level still fits in 64 bits.
+inline Measure measure(uint32_t keep, uint32_t recurse, int level)
+{
+	recurse &= keep;
+	uint32_t solid = keep & ~recurse;
+
+	// Cells of one face layer, and face-adjacent pairs of kept cells by kind.
+	uint64_t face_recurse = 0, face_solid = 0;
+	uint64_t pairs_rr = 0, pairs_rs = 0, pairs_ss = 0;
+	for (int a = 0; a < 27; a++) {
+		if (!((keep >> a) & 1u))
+			continue;
+		if (cell_x(a) == 0) {
+			face_recurse += (recurse >> a) & 1u;
+			face_solid += (solid >> a) & 1u;
+		}
+		for (int b = a + 1; b < 27; b++) {
+			int distance = std::abs(cell_x(a) - cell_x(b)) +
+			               std::abs(cell_y(a) - cell_y(b)) +
+			               std::abs(cell_z(a) - cell_z(b));
+			if (distance != 1 || !((keep >> b) & 1u))
+				continue;
+			bool ra = (recurse >> a) & 1u, rb = (recurse >> b) & 1u;
+			if (ra && rb)
+				pairs_rr++;
+			else if (ra || rb)
+				pairs_rs++;
+			else
+				pairs_ss++;
+		}
+	}
+
+	uint64_t recursive_cells = popcount(recurse);
+	uint64_t solid_cells = popcount(solid);
+	Measure m = { 1, 1, 6 };
+	uint64_t boundary = 1;  // occupied faces on one side of the solid
+	uint64_t face_cells = 1, cube_cells = 1;  // 9^(n-1), 27^(n-1)
+	for (int n = 1; n <= level; n++) {
+		m.surface_faces = recursive_cells * m.surface_faces +
+		                  solid_cells * 6 * face_cells -
+		                  2 * ((pairs_rr + pairs_rs) * boundary + pairs_ss * face_cells);
+		m.cubes = recursive_cells * m.cubes + solid_cells;
+		m.voxels = recursive_cells * m.voxels + solid_cells * cube_cells;
+		boundary = face_recurse * boundary + face_solid * face_cells;
+		face_cells *= 9;
+		cube_cells *= 27;
+	}
+	return m;
+}
+
+template <uint32_t Keep, uint32_t Recurse = Keep>
+struct Rule {
+	static constexpr uint32_t keep = Keep;
+	static constexpr uint32_t recurse = Recurse & Keep;
+	static constexpr uint32_t solid = Keep & ~Recurse;
+
+	static constexpr bool recurses(int cell) { return (recurse >> cell) & 1u; }
+	static constexpr bool is_solid(int cell) { return (solid >> cell) & 1u; }
+
+	// Leaf cubes emitted after `level` subdivision steps.
+	static constexpr uint64_t cubes(int level)
+	{
+		return level == 0 ? 1 :
+			popcount(recurse) * cubes(level - 1) + popcount(solid);
+	}
+
+	static Measure measure(int level)
+	{
+		return subdivision::measure(keep, recurse, level);
+	}
+};
+
+// Keeps corners and edges: the classic sponge.
+typedef Rule<mask_by_centered(true, true, false, false)> MengerRule;
+// Keeps edges and face centers: the lighter Mosely snowflake.
+typedef Rule<mask_by_centered(false, true, true, false)> MoselyRule;
+// The Jerusalem cube shrinks its edge beams by a non-uniform ratio that a
+// 3x3x3 lattice cannot express; on the lattice it keeps the corner cubes
+// recursive and the edge beams solid, which opens the cross-shaped holes.
+typedef Rule<mask_by_centered(true, true, false, false),
+             mask_by_centered(true, false, false, false)> JerusalemRule;
+
+// Cell sizes per depth: sizes[d] is the extent of a cell after d steps.
+// The arithmetic matches the original sponge generator bit for bit.
+inline std::vector<glm::vec3> cell_sizes(const glm::vec3& min,
+                                         const glm::vec3& max, int level)
+{
+	std::vector<glm::vec3> sizes(level + 1);
+	sizes[0] = max - min;
+	for (int l = 1; l <= level; l++)
+		sizes[l] = (max - min) * float(1.0 / std::pow(3.0, l));
+	return sizes;
+}
+
+inline glm::vec3 child_min(const glm::vec3& min, const glm::vec3& size, int cell)
+{
+	return min + glm::vec3(float(cell_x(cell)) * size.x,
+	                       float(cell_y(cell)) * size.y,
+	                       float(cell_z(cell)) * size.z);
+}
+
+template <typename R, int Level> struct Subdivider;
+
+// Visits the 27 cells of one step. The rule is a constant, so every test
+// folds away and only the kept cells remain, fully unrolled.
+template <typename R, int Level, int Cell = 0>
+struct CellLoop {
+	template <typename Emit>
+	static void run(const glm::vec3& min, const glm::vec3* sizes, Emit& emit)
+	{
+		if (R::recurses(Cell))
+			Subdivider<R, Level - 1>::run(child_min(min, sizes[1], Cell),
+			                              sizes + 1, emit);
+		else if (R::is_solid(Cell))
+			emit(child_min(min, sizes[1], Cell),
+			     child_min(min, sizes[1], Cell) + sizes[1]);
+		CellLoop<R, Level, Cell + 1>::run(min, sizes, emit);
+	}
+};
+
+template <typename R, int Level>
+struct CellLoop<R, Level, 27> {
+	template <typename Emit>
+	static void run(const glm::vec3&, const glm::vec3*, Emit&) {}
+};
+
+// Emits every leaf cube of the box at `min`, whose size is sizes[0], after
+// Level more steps. Emit is called as emit(cube_min, cube_max).
+template <typename R, int Level>
+struct Subdivider {
+	template <typename Emit>
+	static void run(const glm::vec3& min, const glm::vec3* sizes, Emit& emit)
+	{
+		CellLoop<R, Level>::run(min, sizes, emit);
+	}
+};
+
+template <typename R>
+struct Subdivider<R, 0> {
+	template <typename Emit>
+	static void run(const glm::vec3& min, const glm::vec3* sizes, Emit& emit)
+	{
+		emit(min, min + sizes[0]);
+	}
+};
+
+// Runtime-level fallback for levels without an unrolled instantiation.
+template <typename R, typename Emit>
+void subdivide_dynamic(const glm::vec3& min, const glm::vec3* sizes,
+                       int level, Emit& emit)
+{
+	if (level == 0) {
+		emit(min, min + sizes[0]);
+		return;
+	}
+	for (int cell = 0; cell < 27; cell++) {
+		if (R::recurses(cell))
+			subdivide_dynamic<R>(child_min(min, sizes[1], cell),
+			                     sizes + 1, level - 1, emit);
+		else if (R::is_solid(cell))
+			emit(child_min(min, sizes[1], cell),
+			     child_min(min, sizes[1], cell) + sizes[1]);
+	}
+}
+
+// Levels 1-4 use the unrolled, level-specialized path. Level 0 is the
+// bounding box itself.
+template <typename R, typename Emit>
+void subdivide(const glm::vec3& min, const glm::vec3& max, int level, Emit& emit)
+{
+	std::vector<glm::vec3> sizes = cell_sizes(min, max, level);
+	switch (level) {
+	case 0: emit(min, max); break;
+	case 1: Subdivider<R, 1>::run(min, sizes.data(), emit); break;
+	case 2: Subdivider<R, 2>::run(min, sizes.data(), emit); break;
+	case 3: Subdivider<R, 3>::run(min, sizes.data(), emit); break;
+	case 4: Subdivider<R, 4>::run(min, sizes.data(), emit); break;
+	default: subdivide_dynamic<R>(min, sizes.data(), level, emit); break;
+	}
+}
+
+};
+
+#endif
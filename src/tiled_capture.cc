@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <debuggl.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include "gl_state.h"
+#include "tiled_capture.h"
+
+namespace {
+	const int kReadBuffers = 2;
+	const int kBytesPerPixel = 4;  // read back as RGBA, the driver's fast path
+
+	struct Tile {
+		int x, y;           // bottom-left corner, GL pixel coordinates
+		int width, height;
+		int buffer;         // pixel buffer it was read into
+	};
+
+	// Copies a finished tile from its pixel buffer into the image file,
+	// flipping rows to the top-down order of PPM and dropping alpha.
+	void write_tile(GLState& gl, const GLuint* pbos, const Tile& tile,
+	                std::fstream& file, std::streamoff header, int image_width,
+	                int image_height, std::vector<char>& row)
+	{
+		const char* pixels = nullptr;
+		size_t bytes = size_t(tile.width) * tile.height * kBytesPerPixel;
+		gl.bind_buffer(GL_PIXEL_PACK_BUFFER, pbos[tile.buffer]);
+		CHECK_GL_ERROR(pixels = static_cast<const char*>(
+			glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT)));
+		CHECK_SUCCESS(pixels != nullptr);
+
+		row.resize(size_t(tile.width) * 3);
+		for (int r = 0; r < tile.height; r++) {
+			const char* src = pixels + size_t(r) * tile.width * kBytesPerPixel;
+			for (int i = 0; i < tile.width; i++)
+				std::copy(src + i * kBytesPerPixel, src + i * kBytesPerPixel + 3,
+				          &row[i * 3]);
+			int image_row = image_height - 1 - (tile.y + r);
+			file.seekp(header + (std::streamoff(image_row) * image_width + tile.x) * 3);
+			file.write(row.data(), row.size());
+		}
+		CHECK_GL_ERROR(glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+	}
+};
+
+glm::mat4
+tile_projection(const glm::mat4& projection, int x, int y,
+                int width, int height, int image_width, int image_height)
+{
+	// The tile's rectangle in normalized device coordinates of the image,
+	// stretched back to [-1, 1]. Both steps act on clip space, so the
+	// result is still a perspective projection.
+	float left = 2.0f * x / image_width - 1.0f;
+	float right = 2.0f * (x + width) / image_width - 1.0f;
+	float bottom = 2.0f * y / image_height - 1.0f;
+	float top = 2.0f * (y + height) / image_height - 1.0f;
+	glm::mat4 fit = glm::scale(glm::mat4(1.0f),
+		glm::vec3(2.0f / (right - left), 2.0f / (top - bottom), 1.0f));
+	fit = glm::translate(fit, glm::vec3(-0.5f * (left + right),
+	                                    -0.5f * (bottom + top), 0.0f));
+	return fit * projection;
+}
+
+bool
+capture_tiled(GLState& gl, const CaptureSettings& settings,
+              const glm::mat4& projection,
+              const std::function<void(const glm::mat4&)>& draw)
+{
+	auto start = std::chrono::steady_clock::now();
+	int width = settings.width, height = settings.height;
+
+	GLint max_renderbuffer = 0, max_viewport[2] = { 0, 0 };
+	CHECK_GL_ERROR(glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &max_renderbuffer));
+	CHECK_GL_ERROR(glGetIntegerv(GL_MAX_VIEWPORT_DIMS, max_viewport));
+	int tile_size = std::min(settings.tile_size, int(max_renderbuffer));
+	tile_size = std::min(tile_size, int(std::min(max_viewport[0], max_viewport[1])));
+
+	// Size the file up front so tiles can be written in any order.
+	std::fstream file(settings.path, std::ios::in | std::ios::out |
+	                  std::ios::binary | std::ios::trunc);
+	if (!file) {
+		std::cerr << "Cannot write capture to " << settings.path << "\n";
+		return false;
+	}
+	std::ostringstream header;
+	header << "P6\n" << width << " " << height << "\n255\n";
+	file << header.str();
+	std::streamoff header_size = header.str().size();
+	file.seekp(header_size + std::streamoff(width) * height * 3 - 1);
+	file.put(0);
+
+	GLuint framebuffer = 0;
+	GLuint renderbuffers[2] = { 0, 0 };
+	GLuint pbos[kReadBuffers] = { 0, 0 };
+	CHECK_GL_ERROR(glGenFramebuffers(1, &framebuffer));
+	CHECK_GL_ERROR(glGenRenderbuffers(2, renderbuffers));
+	gl.bind_framebuffer(framebuffer);
+	CHECK_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]));
+	CHECK_GL_ERROR(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, tile_size, tile_size));
+	CHECK_GL_ERROR(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+	                                         GL_RENDERBUFFER, renderbuffers[0]));
+	CHECK_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]));
+	CHECK_GL_ERROR(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24,
+	                                     tile_size, tile_size));
+	CHECK_GL_ERROR(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+	                                         GL_RENDERBUFFER, renderbuffers[1]));
+	CHECK_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, 0));
+	GLenum status = GL_NONE;
+	CHECK_GL_ERROR(status = glCheckFramebufferStatus(GL_FRAMEBUFFER));
+	CHECK_SUCCESS(status == GL_FRAMEBUFFER_COMPLETE);
+
+	CHECK_GL_ERROR(glGenBuffers(kReadBuffers, pbos));
+	for (int i = 0; i < kReadBuffers; i++) {
+		gl.bind_buffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+		gl.buffer_data(GL_PIXEL_PACK_BUFFER,
+		               size_t(tile_size) * tile_size * kBytesPerPixel,
+		               nullptr, GL_STREAM_READ);
+	}
+	CHECK_GL_ERROR(glPixelStorei(GL_PACK_ALIGNMENT, kBytesPerPixel));
+
+	// Tiles go top to bottom so the file is written mostly in order. Tile
+	// n is read back asynchronously; tile n - 1, whose transfer has had a
+	// whole tile's rendering to finish, is written meanwhile.
+	std::vector<char> row;
+	Tile pending = { 0, 0, 0, 0, -1 };
+	int tiles = 0;
+	for (int top = 0; top < height; top += tile_size) {
+		for (int x = 0; x < width; x += tile_size) {
+			Tile tile;
+			tile.width = std::min(tile_size, width - x);
+			tile.height = std::min(tile_size, height - top);
+			tile.x = x;
+			tile.y = height - top - tile.height;
+			tile.buffer = tiles % kReadBuffers;
+
+			gl.viewport(0, 0, tile.width, tile.height);
+			gl.clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			draw(tile_projection(projection, tile.x, tile.y, tile.width, tile.height,
+			                     width, height));
+
+			gl.bind_buffer(GL_PIXEL_PACK_BUFFER, pbos[tile.buffer]);
+			CHECK_GL_ERROR(glReadPixels(0, 0, tile.width, tile.height,
+			                            GL_RGBA, GL_UNSIGNED_BYTE, 0));
+			if (pending.buffer >= 0)
+				write_tile(gl, pbos, pending, file, header_size, width, height, row);
+			pending = tile;
+			tiles++;
+		}
+	}
+	if (pending.buffer >= 0)
+		write_tile(gl, pbos, pending, file, header_size, width, height, row);
+
+	// Unbind before deleting so the state cache stays accurate.
+	gl.bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+	gl.bind_framebuffer(0);
+	CHECK_GL_ERROR(glDeleteBuffers(kReadBuffers, pbos));
+	CHECK_GL_ERROR(glDeleteRenderbuffers(2, renderbuffers));
+	CHECK_GL_ERROR(glDeleteFramebuffers(1, &framebuffer));
+
+	file.close();
+	if (!file) {
+		std::cerr << "Failed writing capture to " << settings.path << "\n";
+		return false;
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << "Captured " << width << "x" << height << " to " << settings.path
+	          << " in " << tiles << " tiles of " << tile_size << "^2, "
+	          << elapsed.count() << " s\n";
+	return true;
+}
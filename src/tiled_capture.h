@@ -0,0 +1,38 @@
+#ifndef TILED_CAPTURE_H
+#define TILED_CAPTURE_H
+
+#include <functional>
+#include <string>
+#include <glm/glm.hpp>
+
+class GLState;
+
+struct CaptureSettings {
+	int width = 16384;
+	int height = 12288;
+	int tile_size = 2048;  // clamped to what the driver supports
+	std::string path = "capture.ppm";
+};
+
+// Renders an image of any size as a grid of tiles into an offscreen
+// framebuffer and writes it to settings.path as a binary PPM.
+//
+// Each tile is drawn with the part of `projection` it covers, so the tiles
+// join into exactly the image one huge viewport would give. `draw` is
+// called once per tile with that projection; the tile's viewport is bound
+// and cleared. Pixels come back through two pixel buffers, so a tile is
+// read while the next one renders, and each tile is written to its place
+// in the file at once. Memory is bounded by the tile size.
+//
+// Returns false if the file cannot be written.
+bool capture_tiled(GLState& gl, const CaptureSettings& settings,
+                   const glm::mat4& projection,
+                   const std::function<void(const glm::mat4&)>& draw);
+
+// The part of `projection` that maps the pixels [x, x + width) x
+// [y, y + height) of an image_width x image_height viewport onto a whole
+// viewport. Pixel rows count from the bottom, as in GL.
+glm::mat4 tile_projection(const glm::mat4& projection, int x, int y,
+                          int width, int height, int image_width, int image_height);
+
+#endif
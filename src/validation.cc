@@ -0,0 +1,732 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "menger.h"
+#include "mesh_optimizer.h"
+#include "subdivision.h"
+#include "validation.h"
+#include "voxel_grid.h"
+
+namespace {
+	const int kMaxLevel = 4;
+	const int kRandomBoxes = 8;
+	const int kRandomMaxLevel = 3;
+	const unsigned kRandomSeed = 354;
+	// Vertices must land this close (in lattice cells) to a lattice point.
+	const double kLatticeTolerance = 1e-3;
+
+	struct Mesh {
+		std::vector<glm::vec4> vertices;
+		std::vector<glm::vec4> normals;  // empty for modes without normals
+		std::vector<glm::uvec3> faces;
+		std::vector<Menger::Chunk> chunks;  // as recorded by generate_geometry
+	};
+
+	struct Case {
+		Menger::Pattern pattern;
+		int level;
+		glm::vec3 min, max;
+	};
+
+	struct Mode {
+		const char* name;
+		Mesh (*generate)(const Case&);
+		bool ordered;  // faces in generate_geometry order, so chunks() apply
+		Menger::Mesher mesher;
+	};
+
+	/*
+	 * Reference: the original sponge generator, kept as it was before the
+	 * subdivision engine replaced it. Other patterns have no independent
+	 * generator; they are held to the closed-form counts instead.
+	 */
+
+	void legacy_cube(Mesh& mesh, glm::vec3 min, glm::vec3 max)
+	{
+		const glm::vec4 nz(0.0f, 0.0f, 1.0f, 0.0f);
+		const glm::vec4 nx(1.0f, 0.0f, 0.0f, 0.0f);
+		const glm::vec4 ny(0.0f, 1.0f, 0.0f, 0.0f);
+		const glm::vec4 quads[6][4] = {
+			{ glm::vec4(max.x, min.y, min.z, 1.0f), glm::vec4(max.x, max.y, min.z, 1.0f),
+			  glm::vec4(min.x, max.y, min.z, 1.0f), glm::vec4(min.x, min.y, min.z, 1.0f) },
+			{ glm::vec4(max.x, min.y, max.z, 1.0f), glm::vec4(max.x, max.y, max.z, 1.0f),
+			  glm::vec4(min.x, max.y, max.z, 1.0f), glm::vec4(min.x, min.y, max.z, 1.0f) },
+			{ glm::vec4(max.x, min.y, max.z, 1.0f), glm::vec4(max.x, max.y, max.z, 1.0f),
+			  glm::vec4(max.x, max.y, min.z, 1.0f), glm::vec4(max.x, min.y, min.z, 1.0f) },
+			{ glm::vec4(min.x, min.y, max.z, 1.0f), glm::vec4(min.x, max.y, max.z, 1.0f),
+			  glm::vec4(min.x, max.y, min.z, 1.0f), glm::vec4(min.x, min.y, min.z, 1.0f) },
+			{ glm::vec4(min.x, max.y, max.z, 1.0f), glm::vec4(min.x, max.y, min.z, 1.0f),
+			  glm::vec4(max.x, max.y, min.z, 1.0f), glm::vec4(max.x, max.y, max.z, 1.0f) },
+			{ glm::vec4(min.x, min.y, max.z, 1.0f), glm::vec4(min.x, min.y, min.z, 1.0f),
+			  glm::vec4(max.x, min.y, min.z, 1.0f), glm::vec4(max.x, min.y, max.z, 1.0f) },
+		};
+		const glm::vec4 normals[6] = { nz, nz, nx, nx, ny, ny };
+
+		for (int q = 0; q < 6; q++) {
+			unsigned idx = mesh.vertices.size();
+			for (int k = 0; k < 4; k++) {
+				mesh.vertices.push_back(quads[q][k]);
+				mesh.normals.push_back(normals[q]);
+			}
+			mesh.faces.push_back(glm::uvec3(idx, idx + 1, idx + 2));
+			mesh.faces.push_back(glm::uvec3(idx, idx + 2, idx + 3));
+		}
+	}
+
+	Mesh legacy_menger(const Case& c)
+	{
+		Mesh mesh;
+		if (c.level == 0) {
+			legacy_cube(mesh, c.min, c.max);
+			return mesh;
+		}
+
+		std::vector<glm::vec3> mins(1, c.min);
+		for (int l = 1; l <= c.level; l++) {
+			glm::vec3 third = (c.max - c.min) * float(1.0f / pow(3.0f, l));
+			glm::vec3 thirdx = glm::vec3(third.x, 0, 0);
+			glm::vec3 thirdy = glm::vec3(0, third.y, 0);
+			glm::vec3 thirdz = glm::vec3(0, 0, third.z);
+
+			std::vector<glm::vec3> subcubeMins;
+			subcubeMins.swap(mins);
+			for (glm::vec3 minvec : subcubeMins) {
+				mins.push_back(minvec);
+				mins.push_back(minvec + thirdx);
+				mins.push_back(minvec + 2.0f * thirdx);
+				mins.push_back(minvec + thirdz);
+				mins.push_back(minvec + thirdz + 2.0f * thirdx);
+				mins.push_back(minvec + 2.0f * thirdz);
+				mins.push_back(minvec + 2.0f * thirdz + thirdx);
+				mins.push_back(minvec + 2.0f * thirdz + 2.0f * thirdx);
+
+				mins.push_back(minvec + thirdy);
+				mins.push_back(minvec + thirdy + 2.0f * thirdz);
+				mins.push_back(minvec + thirdy + 2.0f * thirdz + 2.0f * thirdx);
+				mins.push_back(minvec + thirdy + 2.0f * thirdx);
+
+				mins.push_back(minvec + 2.0f * thirdy);
+				mins.push_back(minvec + 2.0f * thirdy + thirdx);
+				mins.push_back(minvec + 2.0f * thirdy + 2.0f * thirdx);
+				mins.push_back(minvec + 2.0f * thirdy + thirdz);
+				mins.push_back(minvec + 2.0f * thirdy + thirdz + 2.0f * thirdx);
+				mins.push_back(minvec + 2.0f * thirdy + 2.0f * thirdz);
+				mins.push_back(minvec + 2.0f * thirdy + 2.0f * thirdz + thirdx);
+				mins.push_back(minvec + 2.0f * thirdy + 2.0f * thirdz + 2.0f * thirdx);
+			}
+		}
+
+		glm::vec3 cubeDiag = (c.max - c.min) * float(1.0 / pow(3.0f, c.level));
+		for (const glm::vec3& min : mins)
+			legacy_cube(mesh, min, min + cubeDiag);
+		return mesh;
+	}
+
+	Menger make_menger(const Case& c, Menger::Mesher mesher = Menger::kCulledFaces)
+	{
+		Menger menger(c.min, c.max);
+		menger.set_pattern(c.pattern);
+		menger.set_nesting_level(c.level);
+		menger.set_mesher(mesher);
+		return menger;
+	}
+
+	/*
+	 * Generation modes under test.
+	 */
+
+	Mesh generate_soup(const Case& c)
+	{
+		Mesh mesh;
+		make_menger(c, Menger::kCubeSoup).generate_geometry(mesh.vertices, mesh.normals,
+		                                                    mesh.faces, &mesh.chunks);
+		return mesh;
+	}
+
+	Mesh generate_culled(const Case& c)
+	{
+		Mesh mesh;
+		make_menger(c).generate_geometry(mesh.vertices, mesh.normals, mesh.faces,
+		                                 &mesh.chunks);
+		return mesh;
+	}
+
+	Mesh generate_reference(const Case& c)
+	{
+		if (c.pattern == Menger::kMengerSponge)
+			return legacy_menger(c);
+		return generate_soup(c);
+	}
+
+	// The mapped-buffer path. Storage starts as NaN so any slot left
+	// unwritten falls off the lattice.
+	Mesh generate_spans(const Case& c)
+	{
+		Menger menger = make_menger(c);
+		Mesh mesh;
+		mesh.vertices.assign(menger.vertex_count(), glm::vec4(NAN));
+		mesh.normals.assign(menger.vertex_count(), glm::vec4(NAN));
+		mesh.faces.assign(menger.face_count(), glm::uvec3(~0u));
+		bool written = menger.generate_geometry(
+			Span<glm::vec4>{ mesh.vertices.data(), mesh.vertices.size() },
+			Span<glm::vec4>{ mesh.normals.data(), mesh.normals.size() },
+			Span<glm::uvec3>{ mesh.faces.data(), mesh.faces.size() }, 0, &mesh.chunks);
+		if (!written)
+			mesh.faces.clear();
+		return mesh;
+	}
+
+	// The mapped-buffer path without normals, which shaders derive from
+	// the face's plane instead.
+	Mesh generate_positions(const Case& c)
+	{
+		Menger menger = make_menger(c);
+		Mesh mesh;
+		mesh.vertices.assign(menger.vertex_count(), glm::vec4(NAN));
+		mesh.faces.assign(menger.face_count(), glm::uvec3(~0u));
+		bool written = menger.generate_geometry(
+			Span<glm::vec4>{ mesh.vertices.data(), mesh.vertices.size() },
+			Span<glm::vec4>{ nullptr, 0 },
+			Span<glm::uvec3>{ mesh.faces.data(), mesh.faces.size() }, 0, &mesh.chunks);
+		if (!written)
+			mesh.faces.clear();
+		return mesh;
+	}
+
+	Mesh generate_optimized(const Case& c)
+	{
+		Mesh mesh = generate_culled(c);
+		optimize_vertex_cache(mesh.faces, mesh.vertices.size());
+		optimize_vertex_fetch(mesh.vertices, mesh.normals, mesh.faces);
+		return mesh;
+	}
+
+	// 16-bit ranges, expanded back to absolute indices.
+	Mesh generate_index16(const Case& c)
+	{
+		Mesh mesh = generate_optimized(c);
+		std::vector<uint16_t> indices;
+		std::vector<IndexRange> ranges = build_short_ranges(mesh.faces, indices);
+		for (const IndexRange& range : ranges)
+			for (size_t i = range.first_index; i < range.first_index + range.index_count; i++)
+				mesh.faces[i / 3][i % 3] = indices[i] + range.base_vertex;
+		return mesh;
+	}
+
+	const Mode kModes[] = {
+		{ "soup", generate_soup, true, Menger::kCubeSoup },
+		{ "culled", generate_culled, true, Menger::kCulledFaces },
+		{ "spans", generate_spans, true, Menger::kCulledFaces },
+		{ "positions", generate_positions, true, Menger::kCulledFaces },
+		{ "optimized", generate_optimized, false, Menger::kCulledFaces },
+		{ "index16", generate_index16, false, Menger::kCulledFaces },
+	};
+
+	/*
+	 * Analysis on the level's lattice: n = 3^level cells per side. A
+	 * lattice face is named by its axis, the plane it lies in (0..n) and its
+	 * cell (u, v) in the two following axes.
+	 */
+
+	enum {
+		kCountMask = 0x0f,   // triangles covering the face, saturating
+		kPositive = 0x10,    // winding faces +axis
+		kNormalShift = 5,    // 1 + 2 * axis + negative, 0 if no normal
+	};
+
+	struct Surface {
+		int n;
+		std::vector<uint8_t> faces[3];
+		std::string error;
+	};
+
+	size_t face_index(int n, int plane, int u, int v)
+	{
+		return (size_t(plane) * n + u) * n + v;
+	}
+
+	bool boundary(const Surface& s, int axis, size_t index)
+	{
+		return (s.faces[axis][index] & kCountMask) % 2 == 1;
+	}
+
+	std::string describe_face(int axis, int plane, int u, int v)
+	{
+		std::ostringstream out;
+		out << "face " << "xyz"[axis] << "=" << plane << " cell ("
+		    << "xyz"[(axis + 1) % 3] << "=" << u << ", "
+		    << "xyz"[(axis + 2) % 3] << "=" << v << ")";
+		return out.str();
+	}
+
+	int normal_code(const glm::vec4& normal)
+	{
+		for (int axis = 0; axis < 3; axis++)
+			if (normal[axis] != 0.0f)
+				return 1 + 2 * axis + (normal[axis] < 0.0f);
+		return 0;
+	}
+
+	double edge(const glm::dvec3& a, const glm::dvec3& b, double x, double y)
+	{
+		return (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+	}
+
+	// Marks the lattice faces each triangle covers. A cell counts as covered
+	// when a point near its center, offset so it never lies on a lattice
+	// line or a quad diagonal, is inside the triangle.
+	Surface rasterize(const Mesh& mesh, const Case& c)
+	{
+		Surface s;
+		s.n = int(std::pow(3.0, c.level) + 0.5);
+		int n = s.n;
+		for (int axis = 0; axis < 3; axis++)
+			s.faces[axis].assign(size_t(n + 1) * n * n, 0);
+
+		std::ostringstream error;
+		for (size_t f = 0; f < mesh.faces.size() && error.str().empty(); f++) {
+			glm::ivec3 p[3];
+			for (int k = 0; k < 3; k++) {
+				uint32_t index = mesh.faces[f][k];
+				if (index >= mesh.vertices.size()) {
+					error << "triangle " << f << " indexes vertex " << index
+					      << " of " << mesh.vertices.size();
+					break;
+				}
+				const glm::vec4& vertex = mesh.vertices[index];
+				for (int axis = 0; axis < 3; axis++) {
+					double t = (double(vertex[axis]) - c.min[axis]) /
+					           (double(c.max[axis]) - c.min[axis]) * n;
+					p[k][axis] = int(std::floor(t + 0.5));
+					if (!(std::abs(t - p[k][axis]) < kLatticeTolerance) ||
+					    p[k][axis] < 0 || p[k][axis] > n) {
+						error << "vertex " << index << " (" << vertex.x << ", "
+						      << vertex.y << ", " << vertex.z
+						      << ") is off the lattice of the box";
+						break;
+					}
+				}
+			}
+			if (!error.str().empty())
+				break;
+
+			int axis = -1;
+			for (int a = 0; a < 3; a++)
+				if (p[0][a] == p[1][a] && p[1][a] == p[2][a])
+					axis = a;
+			glm::ivec3 cross = glm::cross(p[1] - p[0], p[2] - p[0]);
+			if (axis < 0 || cross[axis] == 0) {
+				error << "triangle " << f << " is not an axis-aligned lattice triangle";
+				break;
+			}
+
+			int code = 0;
+			if (!mesh.normals.empty()) {
+				code = normal_code(mesh.normals[mesh.faces[f].x]);
+				if (code != normal_code(mesh.normals[mesh.faces[f].y]) ||
+				    code != normal_code(mesh.normals[mesh.faces[f].z])) {
+					error << "triangle " << f << " has differing vertex normals";
+					break;
+				}
+				// --no-normals shades with the positive axis of the plane.
+				if (code != 1 + 2 * axis) {
+					error << "triangle " << f << " in a plane of " << "xyz"[axis]
+					      << " has a normal that cannot be derived from it";
+					break;
+				}
+			}
+
+			int b = (axis + 1) % 3, d = (axis + 2) % 3;
+			glm::dvec3 q[3];
+			for (int k = 0; k < 3; k++)
+				q[k] = glm::dvec3(p[k][b], p[k][d], 0.0);
+			int u0 = std::min(p[0][b], std::min(p[1][b], p[2][b]));
+			int u1 = std::max(p[0][b], std::max(p[1][b], p[2][b]));
+			int v0 = std::min(p[0][d], std::min(p[1][d], p[2][d]));
+			int v1 = std::max(p[0][d], std::max(p[1][d], p[2][d]));
+			uint8_t bits = (cross[axis] > 0 ? kPositive : 0) | (code << kNormalShift);
+			for (int u = u0; u < u1; u++) {
+				for (int v = v0; v < v1; v++) {
+					double x = u + 0.5123, y = v + 0.4871;
+					double e0 = edge(q[0], q[1], x, y);
+					double e1 = edge(q[1], q[2], x, y);
+					double e2 = edge(q[2], q[0], x, y);
+					if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+						continue;
+					uint8_t& entry = s.faces[axis][face_index(n, p[0][axis], u, v)];
+					int count = std::min((entry & kCountMask) + 1, int(kCountMask));
+					entry = count | bits;
+				}
+			}
+		}
+		s.error = error.str();
+		return s;
+	}
+
+	std::string compare_surfaces(const Surface& expected, const Surface& actual,
+	                             bool compare_normals)
+	{
+		int n = expected.n;
+		uint8_t mask = kPositive | (compare_normals ? 0xe0 : 0);
+		for (int axis = 0; axis < 3; axis++) {
+			for (int plane = 0; plane <= n; plane++) {
+				for (int u = 0; u < n; u++) {
+					for (int v = 0; v < n; v++) {
+						size_t i = face_index(n, plane, u, v);
+						bool want = boundary(expected, axis, i);
+						if (want != boundary(actual, axis, i))
+							return describe_face(axis, plane, u, v) +
+							       (want ? " is missing from the surface"
+							             : " is on the surface but should not be");
+						if (!want)
+							continue;
+						uint8_t a = expected.faces[axis][i] & mask;
+						uint8_t b = actual.faces[axis][i] & mask;
+						if ((a ^ b) & kPositive)
+							return describe_face(axis, plane, u, v) + " has flipped winding";
+						if (a != b)
+							return describe_face(axis, plane, u, v) + " has a different normal";
+					}
+				}
+			}
+		}
+		return "";
+	}
+
+	// Every lattice edge must border an even number of surface faces.
+	std::string check_watertight(const Surface& s)
+	{
+		int n = s.n;
+		size_t points = size_t(n + 1) * (n + 1) * (n + 1);
+		std::vector<uint8_t> edges(3 * points, 0);
+		auto toggle = [&](int along, glm::ivec3 at) {
+			edges[along * points + (size_t(at.x) * (n + 1) + at.y) * (n + 1) + at.z] ^= 1;
+		};
+
+		for (int axis = 0; axis < 3; axis++) {
+			int b = (axis + 1) % 3, d = (axis + 2) % 3;
+			for (int plane = 0; plane <= n; plane++) {
+				for (int u = 0; u < n; u++) {
+					for (int v = 0; v < n; v++) {
+						if (!boundary(s, axis, face_index(n, plane, u, v)))
+							continue;
+						glm::ivec3 corner(0, 0, 0);
+						corner[axis] = plane;
+						corner[b] = u;
+						corner[d] = v;
+						glm::ivec3 up_d = corner, up_b = corner;
+						up_d[d]++;
+						up_b[b]++;
+						toggle(b, corner);
+						toggle(b, up_d);
+						toggle(d, corner);
+						toggle(d, up_b);
+					}
+				}
+			}
+		}
+
+		for (size_t i = 0; i < edges.size(); i++) {
+			if (!edges[i])
+				continue;
+			size_t p = i % points;
+			std::ostringstream out;
+			out << "open edge along " << "xyz"[i / points] << " at lattice point ("
+			    << p / ((n + 1) * (n + 1)) << ", " << (p / (n + 1)) % (n + 1)
+			    << ", " << p % (n + 1) << ")";
+			return out.str();
+		}
+		return "";
+	}
+
+	// Solid cells, from the parity of surface faces crossed along x.
+	std::vector<uint8_t> voxelize(const Surface& s)
+	{
+		int n = s.n;
+		std::vector<uint8_t> occupancy(size_t(n) * n * n, 0);
+		for (int y = 0; y < n; y++) {
+			for (int z = 0; z < n; z++) {
+				uint8_t inside = 0;
+				for (int x = 0; x < n; x++) {
+					inside ^= boundary(s, 0, face_index(n, x, y, z));
+					occupancy[(size_t(x) * n + y) * n + z] = inside;
+				}
+			}
+		}
+		return occupancy;
+	}
+
+	std::string compare_occupancy(const std::vector<uint8_t>& expected,
+	                              const std::vector<uint8_t>& actual, int n)
+	{
+		for (size_t i = 0; i < expected.size(); i++) {
+			if (expected[i] == actual[i])
+				continue;
+			std::ostringstream out;
+			out << "voxel (" << i / (size_t(n) * n) << ", " << (i / n) % n << ", "
+			    << i % n << ") should be " << (expected[i] ? "solid" : "empty");
+			return out.str();
+		}
+		return "";
+	}
+
+	std::string check_closed_form(const Surface& s, const std::vector<uint8_t>& occupancy,
+	                              const Case& c)
+	{
+		Menger::Capacity capacity = Menger::capacity(c.pattern, c.level, c.min, c.max);
+		subdivision::Measure m = { 0, 0, 0 };
+		for (uint8_t solid : occupancy)
+			m.voxels += solid;
+		for (int axis = 0; axis < 3; axis++)
+			for (size_t i = 0; i < s.faces[axis].size(); i++)
+				m.surface_faces += boundary(s, axis, i);
+
+		double cell = std::abs(double(c.max.x - c.min.x) * (c.max.y - c.min.y) *
+		                       (c.max.z - c.min.z)) / (double(s.n) * s.n * s.n);
+		std::ostringstream out;
+		if (m.surface_faces != capacity.visible_faces)
+			out << m.surface_faces << " surface faces, capacity() predicts "
+			    << capacity.visible_faces;
+		else if (std::abs(m.voxels * cell - capacity.volume) > 1e-6 * capacity.volume)
+			out << "volume " << m.voxels * cell << ", capacity() predicts "
+			    << capacity.volume;
+		return out.str();
+	}
+
+	// The voxel grid must match the reference solid, and its set operations
+	// must agree with each other on a pair of patterns.
+	std::string check_voxel_grid(const std::vector<uint8_t>& occupancy, const Case& c)
+	{
+		VoxelGrid grid = make_menger(c).voxels();
+		int n = grid.size();
+		for (int x = 0; x < n; x++) {
+			for (int y = 0; y < n; y++) {
+				for (int z = 0; z < n; z++) {
+					if (grid.get(x, y, z) == bool(occupancy[(size_t(x) * n + y) * n + z]))
+						continue;
+					std::ostringstream out;
+					out << "voxel grid cell (" << x << ", " << y << ", " << z
+					    << ") differs from the mesh";
+					return out.str();
+				}
+			}
+		}
+		Menger::Capacity capacity = Menger::capacity(c.pattern, c.level, c.min, c.max);
+		if (grid.surface_faces() != capacity.visible_faces)
+			return "voxel grid surface differs from capacity()";
+
+		Case other = c;
+		other.pattern = Menger::Pattern((c.pattern + 1) % Menger::kNumPatterns);
+		VoxelGrid b = make_menger(other).voxels();
+		VoxelGrid both = grid, either = grid, only = grid;
+		both.intersect(b);
+		either.unite(b);
+		only.subtract(b);
+		if (both.count() + either.count() != grid.count() + b.count() ||
+		    only.count() + both.count() != grid.count())
+			return "voxel grid set operations disagree on counts";
+		only.intersect(b);
+		if (only.count() != 0)
+			return "voxel grid difference overlaps the subtracted grid";
+		return "";
+	}
+
+	// Chunks must tile the face list in order, each face inside its chunk,
+	// and those recorded during generation must match chunks().
+	std::string check_chunks(const Mesh& mesh, const Case& c, Menger::Mesher mesher)
+	{
+		std::vector<Menger::Chunk> chunks = make_menger(c, mesher).chunks();
+		if (mesh.chunks.size() != chunks.size())
+			return "recorded chunks differ in number from chunks()";
+		for (size_t k = 0; k < chunks.size(); k++) {
+			const Menger::Chunk& a = mesh.chunks[k];
+			const Menger::Chunk& b = chunks[k];
+			if (a.first_face != b.first_face || a.face_count != b.face_count ||
+			    a.min != b.min || a.max != b.max) {
+				std::ostringstream out;
+				out << "recorded chunk " << k << " differs from chunks()";
+				return out.str();
+			}
+		}
+		glm::vec3 slack = glm::abs(c.max - c.min) *
+		                  float(kLatticeTolerance / std::pow(3.0, c.level));
+		size_t next = 0;
+		for (size_t k = 0; k < chunks.size(); k++) {
+			const Menger::Chunk& chunk = chunks[k];
+			std::ostringstream out;
+			if (chunk.first_face != next || chunk.first_face + chunk.face_count > mesh.faces.size()) {
+				out << "chunk " << k << " does not follow the previous one";
+				return out.str();
+			}
+			for (size_t f = chunk.first_face; f < chunk.first_face + chunk.face_count; f++) {
+				for (int i = 0; i < 3; i++) {
+					const glm::vec4& p = mesh.vertices[mesh.faces[f][i]];
+					for (int axis = 0; axis < 3; axis++) {
+						if (p[axis] < chunk.min[axis] - slack[axis] ||
+						    p[axis] > chunk.max[axis] + slack[axis]) {
+							out << "triangle " << f << " lies outside chunk " << k;
+							return out.str();
+						}
+					}
+				}
+			}
+			next += chunk.face_count;
+		}
+		if (next != mesh.faces.size())
+			return "chunks do not cover every triangle";
+		return "";
+	}
+
+	// Checks one mode (or the reference itself when mode is null) on one
+	// case. Returns an empty string on success.
+	std::string check(const Mode* mode, const Case& c)
+	{
+		Mesh reference = generate_reference(c);
+		Surface expected = rasterize(reference, c);
+		if (!expected.error.empty())
+			return "reference: " + expected.error;
+		std::vector<uint8_t> expected_occupancy = voxelize(expected);
+
+		if (!mode) {
+			std::string error = check_watertight(expected);
+			if (error.empty())
+				error = check_closed_form(expected, expected_occupancy, c);
+			if (error.empty())
+				error = check_voxel_grid(expected_occupancy, c);
+			return error;
+		}
+
+		Mesh mesh = mode->generate(c);
+		if (mesh.faces.empty())
+			return "no geometry generated";
+		Surface actual = rasterize(mesh, c);
+		std::string error = actual.error;
+		if (error.empty())
+			error = compare_surfaces(expected, actual, !mesh.normals.empty());
+		if (error.empty())
+			error = check_watertight(actual);
+		if (error.empty())
+			error = compare_occupancy(expected_occupancy, voxelize(actual), expected.n);
+		if (error.empty() && mode->ordered)
+			error = check_chunks(mesh, c, mode->mesher);
+		return error;
+	}
+
+	std::string repro(const Mode* mode, const Case& c)
+	{
+		std::ostringstream out;
+		out.precision(9);
+		out << "--validate " << (mode ? mode->name : "reference") << " "
+		    << Menger::pattern_name(c.pattern) << " " << c.level << " "
+		    << c.min.x << " " << c.min.y << " " << c.min.z << " "
+		    << c.max.x << " " << c.max.y << " " << c.max.z;
+		return out.str();
+	}
+
+	// Runs one case and reports a failure at the lowest failing level.
+	bool run(const Mode* mode, const Case& c)
+	{
+		std::string error = check(mode, c);
+		if (error.empty())
+			return true;
+
+		Case minimal = c;
+		for (int level = 0; level < c.level; level++) {
+			Case lower = c;
+			lower.level = level;
+			std::string lower_error = check(mode, lower);
+			if (!lower_error.empty()) {
+				minimal = lower;
+				error = lower_error;
+				break;
+			}
+		}
+		std::cout << "FAIL " << (mode ? mode->name : "reference") << " "
+		          << Menger::pattern_name(c.pattern) << " level " << c.level
+		          << ": " << error << "\n     repro: menger " << repro(mode, minimal)
+		          << "\n";
+		return false;
+	}
+
+	bool parse_case(int argc, char* argv[], const Mode** mode, Case* c)
+	{
+		if (argc != 9)
+			return false;
+		*mode = nullptr;
+		for (const Mode& m : kModes)
+			if (strcmp(argv[0], m.name) == 0)
+				*mode = &m;
+		if (!*mode && strcmp(argv[0], "reference") != 0)
+			return false;
+
+		int pattern = 0;
+		while (pattern < Menger::kNumPatterns &&
+		       strcmp(argv[1], Menger::pattern_name(Menger::Pattern(pattern))) != 0)
+			pattern++;
+		if (pattern == Menger::kNumPatterns)
+			return false;
+		c->pattern = Menger::Pattern(pattern);
+		c->level = atoi(argv[2]);
+		for (int k = 0; k < 3; k++) {
+			c->min[k] = strtof(argv[3 + k], nullptr);
+			c->max[k] = strtof(argv[6 + k], nullptr);
+		}
+		return c->level >= 0;
+	}
+};
+
+int validate_geometry(int argc, char* argv[])
+{
+	if (argc > 0) {
+		const Mode* mode = nullptr;
+		Case c;
+		if (!parse_case(argc, argv, &mode, &c)) {
+			std::cerr << "Usage: menger --validate [<mode> <pattern> <level> "
+			             "<min x y z> <max x y z>]\n";
+			return EXIT_FAILURE;
+		}
+		bool ok = run(mode, c);
+		std::cout << (ok ? "PASS" : "FAILED") << "\n";
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	std::vector<Case> cases;
+	for (int p = 0; p < Menger::kNumPatterns; p++) {
+		for (int level = 0; level <= kMaxLevel; level++) {
+			Case c = { Menger::Pattern(p), level,
+			           glm::vec3(-0.5f, -0.5f, -0.5f), glm::vec3(0.5f, 0.5f, 0.5f) };
+			cases.push_back(c);
+		}
+	}
+	std::mt19937 rng(kRandomSeed);
+	std::uniform_real_distribution<float> origin(-2.0f, 2.0f);
+	std::uniform_real_distribution<float> extent(0.05f, 3.0f);
+	for (int i = 0; i < kRandomBoxes; i++) {
+		glm::vec3 min(origin(rng), origin(rng), origin(rng));
+		glm::vec3 max = min + glm::vec3(extent(rng), extent(rng), extent(rng));
+		for (int p = 0; p < Menger::kNumPatterns; p++) {
+			Case c = { Menger::Pattern(p), int(rng() % (kRandomMaxLevel + 1)), min, max };
+			cases.push_back(c);
+		}
+	}
+
+	int checks = 0, failures = 0;
+	for (const Case& c : cases) {
+		failures += !run(nullptr, c);
+		checks++;
+		for (const Mode& mode : kModes) {
+			failures += !run(&mode, c);
+			checks++;
+		}
+	}
+	std::cout << "Validation: " << checks << " checks over " << cases.size()
+	          << " cases (random seed " << kRandomSeed << "), "
+	          << failures << " failed\n";
+	return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
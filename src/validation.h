@@ -0,0 +1,18 @@
+#ifndef VALIDATION_H
+#define VALIDATION_H
+
+// Headless differential validation of the sponge generation modes.
+//
+// Every mode is compared with the reference generator for every pattern and
+// level, on the unit box and on random boxes: lattice faces covered by the
+// surface, their winding and normals, watertightness and voxel occupancy.
+// The reference is also checked against the closed-form counts and the
+// voxel grid. Each failure prints the arguments that rerun just that case
+// at its lowest failing level:
+//
+//	menger --validate <mode> <pattern> <level> <min x y z> <max x y z>
+//
+// Takes the arguments that follow --validate and returns the exit status.
+int validate_geometry(int argc, char* argv[]);
+
+#endif
@@ -0,0 +1,251 @@
+#include <algorithm>
+#include "voxel_grid.h"
+#include "subdivision.h"
+
+namespace {
+	const int kWordBits = 64;
+
+	int popcount64(uint64_t word)
+	{
+		return __builtin_popcountll(word);
+	}
+};
+
+VoxelGrid::VoxelGrid(int size)
+	: size_(size),
+	  words_((uint64_t(size) * size * size + kWordBits - 1) / kWordBits, 0)
+{
+}
+
+VoxelGrid
+VoxelGrid::from_rule(uint32_t keep, uint32_t recurse, int level)
+{
+	int size = 1;
+	for (int l = 0; l < level; l++)
+		size *= 3;
+	VoxelGrid grid(size);
+	grid.fill_rule(keep, recurse & keep, 0, 0, 0, size);
+	return grid;
+}
+
+size_t
+VoxelGrid::index(int x, int y, int z) const
+{
+	return size_t(x) + size_t(size_) * (size_t(z) + size_t(size_) * y);
+}
+
+size_t
+VoxelGrid::stride(int axis) const
+{
+	switch (axis) {
+	case 0: return 1;
+	case 2: return size_;
+	default: return size_t(size_) * size_;
+	}
+}
+
+bool
+VoxelGrid::get(int x, int y, int z) const
+{
+	size_t i = index(x, y, z);
+	return (words_[i / kWordBits] >> (i % kWordBits)) & 1u;
+}
+
+void
+VoxelGrid::set(int x, int y, int z, bool solid)
+{
+	size_t i = index(x, y, z);
+	uint64_t bit = uint64_t(1) << (i % kWordBits);
+	if (solid)
+		words_[i / kWordBits] |= bit;
+	else
+		words_[i / kWordBits] &= ~bit;
+}
+
+uint64_t
+VoxelGrid::row(int x, int y, int z, int count) const
+{
+	size_t first = index(x, y, z);
+	size_t word = first / kWordBits;
+	unsigned bit = first % kWordBits;
+	uint64_t bits = words_[word] >> bit;
+	if (bit && bit + count > kWordBits)
+		bits |= words_[word + 1] << (kWordBits - bit);
+	return count == kWordBits ? bits : bits & ((uint64_t(1) << count) - 1);
+}
+
+uint64_t
+VoxelGrid::count_box(int x, int y, int z, int extent) const
+{
+	uint64_t total = 0;
+	for (int dy = 0; dy < extent; dy++)
+		for (int dz = 0; dz < extent; dz++)
+			for (int dx = 0; dx < extent; dx += kWordBits)
+				total += popcount64(row(x + dx, y + dy, z + dz,
+				                        std::min(kWordBits, extent - dx)));
+	return total;
+}
+
+// Sets or clears bits [first, first + count), whole words at a time.
+void
+VoxelGrid::fill(size_t first, size_t count, bool solid)
+{
+	size_t last = first + count;
+	while (first < last) {
+		size_t word = first / kWordBits;
+		size_t bit = first % kWordBits;
+		size_t span = std::min<size_t>(kWordBits - bit, last - first);
+		uint64_t mask = span == kWordBits ? ~uint64_t(0) :
+			((uint64_t(1) << span) - 1) << bit;
+		if (solid)
+			words_[word] |= mask;
+		else
+			words_[word] &= ~mask;
+		first += span;
+	}
+}
+
+// Each row of the box is a contiguous run of bits.
+void
+VoxelGrid::fill_box(int x, int y, int z, int extent)
+{
+	for (int dy = 0; dy < extent; dy++)
+		for (int dz = 0; dz < extent; dz++)
+			fill(index(x, y + dy, z + dz), extent, true);
+}
+
+void
+VoxelGrid::fill_rule(uint32_t keep, uint32_t recurse, int x, int y, int z, int extent)
+{
+	if (extent == 1) {
+		set(x, y, z, true);
+		return;
+	}
+	int child = extent / 3;
+	for (int cell = 0; cell < 27; cell++) {
+		if (!((keep >> cell) & 1u))
+			continue;
+		int cx = x + subdivision::cell_x(cell) * child;
+		int cy = y + subdivision::cell_y(cell) * child;
+		int cz = z + subdivision::cell_z(cell) * child;
+		if ((recurse >> cell) & 1u)
+			fill_rule(keep, recurse, cx, cy, cz, child);
+		else
+			fill_box(cx, cy, cz, child);
+	}
+}
+
+void
+VoxelGrid::clear_plane(int axis, int coord)
+{
+	switch (axis) {
+	case 0:
+		for (int y = 0; y < size_; y++)
+			for (int z = 0; z < size_; z++)
+				set(coord, y, z, false);
+		break;
+	case 2:
+		for (int y = 0; y < size_; y++)
+			fill(index(0, y, coord), size_, false);
+		break;
+	default:
+		fill(index(0, coord, 0), size_t(size_) * size_, false);
+		break;
+	}
+}
+
+// Bits past the last cell are kept clear so counts and comparisons can
+// work on whole words.
+void
+VoxelGrid::clear_padding()
+{
+	uint64_t cells = cell_count();
+	if (cells % kWordBits)
+		words_.back() &= (uint64_t(1) << (cells % kWordBits)) - 1;
+}
+
+bool
+VoxelGrid::unite(const VoxelGrid& other)
+{
+	if (other.size_ != size_)
+		return false;
+	for (size_t w = 0; w < words_.size(); w++)
+		words_[w] |= other.words_[w];
+	return true;
+}
+
+bool
+VoxelGrid::intersect(const VoxelGrid& other)
+{
+	if (other.size_ != size_)
+		return false;
+	for (size_t w = 0; w < words_.size(); w++)
+		words_[w] &= other.words_[w];
+	return true;
+}
+
+bool
+VoxelGrid::subtract(const VoxelGrid& other)
+{
+	if (other.size_ != size_)
+		return false;
+	for (size_t w = 0; w < words_.size(); w++)
+		words_[w] &= ~other.words_[w];
+	return true;
+}
+
+uint64_t
+VoxelGrid::count() const
+{
+	uint64_t total = 0;
+	for (uint64_t word : words_)
+		total += popcount64(word);
+	return total;
+}
+
+// The neighbor of bit i is bit i +/- stride, so the mask is the whole grid
+// shifted by the axis stride. Cells on the far plane would pick up the
+// next row or slab and are cleared.
+VoxelGrid
+VoxelGrid::neighbors(int axis, bool positive) const
+{
+	VoxelGrid result(size_);
+	size_t words = words_.size();
+	size_t shift = stride(axis);
+	size_t q = shift / kWordBits;
+	unsigned r = shift % kWordBits;
+	for (size_t w = 0; w < words; w++) {
+		uint64_t lo, hi;
+		if (positive) {
+			lo = w + q < words ? words_[w + q] : 0;
+			hi = w + q + 1 < words ? words_[w + q + 1] : 0;
+			result.words_[w] = r ? (lo >> r) | (hi << (kWordBits - r)) : lo;
+		} else {
+			lo = w >= q + 1 ? words_[w - q - 1] : 0;
+			hi = w >= q ? words_[w - q] : 0;
+			result.words_[w] = r ? (hi << r) | (lo >> (kWordBits - r)) : hi;
+		}
+	}
+	result.clear_plane(axis, positive ? size_ - 1 : 0);
+	result.clear_padding();
+	return result;
+}
+
+VoxelGrid
+VoxelGrid::exposed(int axis, bool positive) const
+{
+	VoxelGrid result = *this;
+	result.subtract(neighbors(axis, positive));
+	return result;
+}
+
+uint64_t
+VoxelGrid::surface_faces() const
+{
+	uint64_t total = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		total += exposed(axis, true).count();
+		total += exposed(axis, false).count();
+	}
+	return total;
+}